@@ -0,0 +1,271 @@
+/**
+*************************************************************
+* @file bench01.cpp
+* @brief Umon benchmark
+* Measures the time, syscalls and memory allocations taken by
+* process and mount points summaries. It's meant to be used with
+* a synthetic tree created with procgen.cpp, but it can run over
+* the real system too.
+*
+* @author Gaspar Fernández <blakeyed@totaki.com>
+* @version 0.1 Alpha
+* @date 18 oct 2026
+*
+* Usage:
+*   $ ./procgen /tmp/fakeproc 50000
+*   $ ./bench01 /tmp/fakeproc [iterations=10]
+*   $ ./bench01 / [iterations=10]     (real system)
+*
+* Notes:
+*   - syscalls are the number of read-class and write-class syscalls
+*     taken from /proc/self/io (syscr + syscw). open/close/getdents
+*     calls are not there, but we have one open and one close per
+*     read file, so it's still a good indicator.
+*   - io_uring reads don't count as read syscalls in /proc/self/io,
+*     syscalls for buildProcSummary(uring) are just getdents64 ones.
+*     Umon::Stats counters have io_uring_enter() calls.
+*   - History::record writes one record of sysinfo, mount points and
+*     top 32 process names, the first one a keyframe.
+*   - buildProcSummary(sched) reads schedstat files too (Proc::schedstat())
+*   - buildProcSummary(groups) keeps cgroup groups totals (Proc::grouping()).
+*     Keys are found before (when grouping is set), so it's the cost of
+*     keeping totals up to date.
+*   - Collector<NAME> reads process names only: stat files are parsed
+*     up to the name.
+*   - Fixed::refresh is sysinfo, processes (name, state, RSS, %CPU) and
+*     mount points with capacity for all of them: it shouldn't allocate.
+*   - Proc::query is pcpu >= 0 and state == R, summing RSS. Columns
+*     are built before, as buildProcSummary() won't read processes again.
+*   - Sockets::count is TCP sockets from sock_diag netlink, always the
+*     real system's (there aren't sockets in a synthetic tree).
+*   - scanStep(pass) is a whole incremental pass, made of 5ms steps.
+*     Idle processes read recently are skipped.
+*   - allocations are counted replacing malloc() family (glibc only)
+*   - buildAdvancedSummary(reload=true) also rebuilds process summary,
+*     so its time includes buildProcSummary() time. The same for
+*     memoryDetails: it's buildProcSummary() reading smaps_rollup
+*     files too (just the first time, as RSS doesn't change later).
+*
+*************************************************************/
+
+#include "umon.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t nmemb, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+
+  static std::atomic<unsigned long> allocations(0);
+
+  void *malloc(size_t size)
+  {
+    ++allocations;
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t nmemb, size_t size)
+  {
+    ++allocations;
+    return __libc_calloc(nmemb, size);
+  }
+
+  void *realloc(void *ptr, size_t size)
+  {
+    ++allocations;
+    return __libc_realloc(ptr, size);
+  }
+}
+
+using namespace std;
+
+namespace
+{
+  /** Read + write syscalls made by us so far */
+  unsigned long long syscallCount()
+  {
+    std::string io = Umon::extractFile("/proc/self/io");
+    unsigned long long syscr=0, syscw=0;
+    const char *r = strstr(io.c_str(), "syscr:");
+    const char *w = strstr(io.c_str(), "syscw:");
+    if (r)
+      sscanf(r, "syscr: %llu", &syscr);
+    if (w)
+      sscanf(w, "syscw: %llu", &syscw);
+    return syscr + syscw;
+  }
+
+  struct StageStats
+  {
+    std::string name;
+    double minTime, maxTime, totalTime;
+    unsigned long long syscalls;
+    unsigned long allocs;
+    unsigned runs;
+  };
+
+  /** Runs a stage several times and collects its stats */
+  StageStats runStage(std::string name, unsigned iterations, std::function<void()> stage)
+  {
+    StageStats st({name, 1e99, 0, 0, 0, 0, 0});
+    for (unsigned i=0; i<iterations; ++i)
+      {
+	/* syscallCount() itself reads a file, so it's counted once and discounted */
+	unsigned long long sc = syscallCount();
+	unsigned long al = allocations;
+	auto start = std::chrono::steady_clock::now();
+	stage();
+	double t = std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(std::chrono::steady_clock::now()-start).count();
+	st.allocs += allocations - al;
+	st.syscalls += syscallCount() - sc - 1;
+	st.totalTime += t;
+	st.minTime = std::min(st.minTime, t);
+	st.maxTime = std::max(st.maxTime, t);
+	++st.runs;
+      }
+    return st;
+  }
+
+  void printStage(StageStats st, unsigned long items)
+  {
+    cout << setw(24) << left << st.name << right
+	 << setw(12) << fixed << setprecision(3) << st.minTime*1000
+	 << setw(12) << st.totalTime*1000/st.runs
+	 << setw(12) << st.maxTime*1000
+	 << setw(12) << st.syscalls/st.runs
+	 << setw(12) << st.allocs/st.runs
+	 << setw(12) << ((items)?st.totalTime*1e9/st.runs/items:0)
+	 << endl;
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+      cerr << "Usage: "<<argv[0]<<" <root> [iterations=10]"<<endl;
+      cerr << "   root is a directory created by procgen, or / to benchmark this system"<<endl;
+      return 1;
+    }
+  std::string root = argv[1];
+  unsigned iterations = (argc>2)?atoi(argv[2]):10;
+  if (iterations == 0)
+    iterations = 1;
+
+  if (root != "/")
+    {
+      Umon::procRoot(root+"/proc");
+      Umon::mtabFile(root+"/mtab");
+      Umon::cgroupRoot(root+"/cgroup");
+      Umon::sysRoot(root+"/sys");
+    }
+
+  /* First build is special: every process is new. */
+  auto first = runStage("buildProcSummary(1st)", 1, [](){ Umon::Proc::buildProcSummary(true); });
+  unsigned long nprocs = Umon::Proc::processCount();
+  auto procs = runStage("buildProcSummary", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  auto advanced = runStage("buildAdvancedSummary", iterations, [](){ Umon::Proc::buildAdvancedSummary(true); });
+  /* %CPU in ns: one more file per process */
+  Umon::Proc::schedstat(true);
+  auto schedstat = runStage("buildProcSummary(sched)", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  Umon::Proc::schedstat(false);
+  /* Totals by cgroup kept while scanning */
+  Umon::Proc::grouping(Umon::Proc::GROUP_CGROUP);
+  auto grouped = runStage("buildProcSummary(groups)", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  Umon::Proc::grouping(Umon::Proc::GROUP_NAME);
+  /* Just names, no summary */
+  Umon::Proc::Collector<Umon::Proc::FIELD_NAME> names;
+  auto collector = runStage("Collector<NAME>", iterations, [&names](){ names.scan(); });
+  /* Everything with fixed capacity, allocated once */
+  Umon::Fixed::Monitor<> fixedMonitor;
+  fixedMonitor.init({(unsigned)nprocs*2, 1024, 4096});
+  fixedMonitor.refresh();
+  auto fixed = runStage("Fixed::refresh", iterations, [&fixedMonitor](){ fixedMonitor.refresh(); });
+  /* Filter and aggregate over process columns (already built, summary isn't read again) */
+  Umon::Proc::columns();
+  auto query = runStage("Proc::query", iterations, [](){
+      Umon::Proc::Predicate where[] = { { Umon::Proc::COLUMN_PCPU, Umon::Proc::CMP_GE, 0 },
+					{ Umon::Proc::COLUMN_STATE, Umon::Proc::CMP_EQ, Umon::Proc::STATE_RUNNING } };
+      Umon::Proc::query(where, 2, 1<<Umon::Proc::COLUMN_RSS);
+    });
+  /* Same summary, but reading stat files in batches with io_uring (if we can) */
+  bool uring = Umon::Proc::ioUring(true);
+  auto batched = runStage((uring)?"buildProcSummary(uring)":"(no io_uring)", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  Umon::Proc::ioUring(false);
+  /* Whole incremental passes in 5ms steps: idle processes are skipped */
+  auto steps = runStage("scanStep(pass)", iterations, [](){ while (!Umon::Proc::scanStep(0.005)); });
+  Umon::Proc::memoryDetails(true);
+  Umon::Proc::memoryDetailsBudget(10);	/* we want to know how much it takes */
+  auto memory = runStage("memoryDetails(1st)", 1, [](){ Umon::Proc::buildProcSummary(true); });
+  auto memoryCached = runStage("memoryDetails", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  Umon::Proc::memoryDetails(false);
+  Umon::valueCheckInterval(500);
+  auto mounts = runStage("mountsInfo", iterations, [](){ Umon::Mounts::mountsInfo(true); });
+  unsigned long nmounts = Umon::Mounts::mountsInfo().size();
+  auto cgroups = runStage("Cgroup::subtree", iterations, [](){ Umon::Cgroup::subtree("/", true); });
+  unsigned long ncgroups = Umon::Cgroup::subtree("/").size();
+  auto sockets = runStage("Sockets::count", iterations, [](){ Umon::Sockets::count(); });
+  unsigned long nsockets = Umon::Sockets::count().total;
+
+  /* History records (to a temporary file). First one is a keyframe */
+  char historyFile[] = "/tmp/bench01-historyXXXXXX";
+  int historyFd = mkstemp(historyFile);
+  Umon::History::Recorder recorder;
+  if (historyFd != -1)
+    {
+      close(historyFd);
+      recorder.open(historyFile, 64*1024*1024);
+    }
+  recorder.keyframeInterval(1000000);
+  Umon::Proc::buildProcSummary(true);
+  auto history = runStage("History::record", iterations, [&recorder](){ recorder.record(); });
+  recorder.close();
+  unlink(historyFile);
+
+  cout << "Root: "<<root<<" Processes: "<<nprocs<<" Mount points: "<<nmounts<<" cgroups: "<<ncgroups<<" Iterations: "<<iterations<<endl;
+  cout << setw(24) << left << "stage" << right
+       << setw(12) << "min(ms)" << setw(12) << "avg(ms)" << setw(12) << "max(ms)"
+       << setw(12) << "syscalls" << setw(12) << "allocs" << setw(12) << "ns/item" << endl;
+  printStage(first, nprocs);
+  printStage(procs, nprocs);
+  printStage(advanced, nprocs);
+  printStage(schedstat, nprocs);
+  printStage(grouped, nprocs);
+  printStage(collector, nprocs);
+  printStage(fixed, nprocs);
+  printStage(query, nprocs);
+  printStage(batched, nprocs);
+  printStage(steps, nprocs);
+  printStage(memory, nprocs);
+  printStage(memoryCached, nprocs);
+  printStage(mounts, nmounts);
+  printStage(cgroups, ncgroups);
+  printStage(sockets, nsockets);
+  printStage(history, 0);
+
+  /* Umon's own instrumentation, and what it costs */
+  cout << endl << setw(24) << left << "Umon::Stats stage" << right
+       << setw(12) << "count" << setw(12) << "mean(ms)" << setw(12) << "p50(ms)"
+       << setw(12) << "p99(ms)" << setw(12) << "max(ms)" << endl;
+  for (int i=0; i<Umon::Stats::STAGE_COUNT; ++i)
+    {
+      auto h = Umon::Stats::histogram((Umon::Stats::Stage)i);
+      cout << setw(24) << left << Umon::Stats::stageName((Umon::Stats::Stage)i) << right
+	   << setw(12) << h.count << setw(12) << h.mean()*1000 << setw(12) << h.percentile(0.5)*1000
+	   << setw(12) << h.percentile(0.99)*1000 << setw(12) << h.max/1e6 << endl;
+    }
+  auto c = Umon::Stats::counters();
+  cout << "Counters: syscalls="<<c.syscalls<<" bytesRead="<<c.bytesRead<<" allocations="<<c.allocations
+       <<" timeouts="<<c.timeouts<<" cancellations="<<c.cancellations<<" refreshes="<<c.refreshes<<endl;
+
+  Umon::Stats::enabled(false);
+  auto off = runStage("buildProcSummary", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  Umon::Stats::enabled(true);
+  auto on = runStage("buildProcSummary", iterations, [](){ Umon::Proc::buildProcSummary(true); });
+  cout << "Instrumentation overhead: "<<setprecision(2)<<(on.minTime/off.minTime-1)*100<<"% (best of "<<iterations<<" runs)"<<endl;
+
+  return 0;
+}
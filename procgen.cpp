@@ -0,0 +1,273 @@
+/**
+*************************************************************
+* @file procgen.cpp
+* @brief Synthetic /proc tree generator
+* Builds a fake /proc and mtab with the number of processes and
+* mount points we want, so we can test or benchmark umon.h with
+* 50k or 200k processes in any machine.
+*
+* @author Gaspar Fernández <blakeyed@totaki.com>
+* @version 0.1 Alpha
+* @date 18 oct 2026
+*
+* Usage:
+*   $ ./procgen <directory> <processes> [mounts=16] [seed=1]
+* It will create:
+*   <directory>/proc/uptime
+*   <directory>/proc/<pid>/stat
+*   <directory>/proc/<pid>/cgroup
+*   <directory>/proc/<pid>/smaps_rollup
+*   <directory>/proc/<pid>/schedstat
+*   <directory>/cgroup/system.slice/<name>.service/  (cgroup v2 files)
+*   <directory>/sys/devices/system/{cpu,node}/  (2 NUMA nodes, 8 CPUs)
+*   <directory>/sys/class/{hwmon,thermal}/     (sensors)
+*   <directory>/mtab
+*   <directory>/mnt/<n>        (mount point directories)
+* Then point Umon to it:
+*   Umon::procRoot("<directory>/proc");
+*   Umon::mtabFile("<directory>/mtab");
+*   Umon::cgroupRoot("<directory>/cgroup");
+*   Umon::sysRoot("<directory>/sys");
+*
+*************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <string>
+#include <cctype>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+using namespace std;
+
+namespace
+{
+  /* Process names. Some of them repeated a lot (like forks) and some of them
+     with spaces and parenthesis to stress the parser. */
+  const char* names[] = { "nginx", "php-fpm7.0", "postgres", "java", "bash",
+			  "sshd", "kworker/0:1", "systemd", "redis-server",
+			  "python3", "apache2", "(sd-pam)", "tmux: server",
+			  "cron", "rsyslogd", "mysqld" };
+  const char states[] = "RSSSSSSSDZTI";
+  const double uptimeSecs = 864000.25;
+
+  /* Tiny LCG. We want the same tree for the same seed. */
+  unsigned long long lcgState = 1;
+  unsigned rnd(unsigned max)
+  {
+    lcgState = lcgState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (max)?(unsigned)((lcgState >> 33) % max):0;
+  }
+
+  bool makeDir(string path)
+  {
+    return ( (mkdir(path.c_str(), 0755) == 0) || (errno == EEXIST) );
+  }
+
+  bool writeFile(string path, string contents)
+  {
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL)
+      return false;
+
+    fwrite(contents.c_str(), 1, contents.size(), f);
+    fclose(f);
+    return true;
+  }
+
+  /** Service (cgroup) name for a process name  */
+  string serviceName(const char* name)
+  {
+    string service;
+    for (const char* c = name; *c; ++c)
+      service+=(isalnum(*c))?*c:'-';
+    return "/system.slice/"+service+".service";
+  }
+
+  /** Writes cgroup v2 files for a service  */
+  bool writeCgroup(string root, string service)
+  {
+    char data[512];
+    string dir = root+service;
+    if (!makeDir(dir))
+      return false;
+
+    snprintf(data, 512, "usage_usec %u\nuser_usec %u\nsystem_usec %u\nnr_periods 0\nnr_throttled 0\nthrottled_usec 0\n",
+	     rnd(1000000000), rnd(800000000), rnd(200000000));
+    writeFile(dir+"/cpu.stat", data);
+    snprintf(data, 512, "%llu\n", (unsigned long long)rnd(1000000)*4096);
+    writeFile(dir+"/memory.current", data);
+    snprintf(data, 512, "anon %llu\nfile %llu\nkernel_stack 16384\nslab 65536\nsock 0\nshmem 0\npgfault %u\npgmajfault %u\n",
+	     (unsigned long long)rnd(500000)*4096, (unsigned long long)rnd(500000)*4096, rnd(1000000), rnd(1000));
+    writeFile(dir+"/memory.stat", data);
+    snprintf(data, 512, "8:0 rbytes=%u wbytes=%u rios=%u wios=%u dbytes=0 dios=0\n",
+	     rnd(1000000000), rnd(1000000000), rnd(100000), rnd(100000));
+    return writeFile(dir+"/io.stat", data);
+  }
+
+  /** Two sockets, two cores per socket with two threads each, a NUMA node per socket  */
+  bool writeTopology(string root)
+  {
+    char data[1024];
+    string cpuDir = root+"/sys/devices/system/cpu/", nodeDir = root+"/sys/devices/system/node/";
+    if ( (!makeDir(root+"/sys")) || (!makeDir(root+"/sys/devices")) || (!makeDir(root+"/sys/devices/system")) ||
+	 (!makeDir(cpuDir)) || (!makeDir(nodeDir)) )
+      return false;
+
+    writeFile(cpuDir+"possible", "0-7\n");
+    writeFile(cpuDir+"online", "0-7\n");
+    for (unsigned c=0; c<8; ++c)
+      {
+	string dir = cpuDir+"cpu"+to_string(c);
+	makeDir(dir);
+	makeDir(dir+"/topology");
+	writeFile(dir+"/topology/core_id", to_string((c/2)%2)+"\n");
+	writeFile(dir+"/topology/physical_package_id", to_string(c/4)+"\n");
+      }
+    writeFile(nodeDir+"online", "0-1\n");
+    for (unsigned n=0; n<2; ++n)
+      {
+	string dir = nodeDir+"node"+to_string(n);
+	makeDir(dir);
+	writeFile(dir+"/cpulist", (n)?"4-7\n":"0-3\n");
+	unsigned long total = 16777216, free = rnd(total);
+	snprintf(data, 1024, "Node %u MemTotal:       %lu kB\nNode %u MemFree:        %lu kB\nNode %u MemUsed:        %lu kB\n"
+		 "Node %u FilePages:      %u kB\nNode %u AnonPages:      %u kB\nNode %u Shmem:          %u kB\nNode %u Slab:           %u kB\n",
+		 n, total, n, free, n, total-free, n, rnd(total-free), n, rnd(total-free), n, rnd(65536), n, rnd(262144));
+	writeFile(dir+"/meminfo", data);
+	snprintf(data, 1024, "numa_hit %u\nnuma_miss %u\nnuma_foreign %u\ninterleave_hit %u\nlocal_node %u\nother_node %u\n",
+		 rnd(100000000), rnd(1000000), rnd(1000000), rnd(10000), rnd(100000000), rnd(1000000));
+	writeFile(dir+"/numastat", data);
+      }
+    return true;
+  }
+
+  /** coretemp (package and core temperatures), a fans and power chip and a thermal zone  */
+  bool writeSensors(string root)
+  {
+    string hwmon = root+"/sys/class/hwmon/", thermal = root+"/sys/class/thermal/";
+    if ( (!makeDir(root+"/sys/class")) || (!makeDir(hwmon)) || (!makeDir(thermal)) ||
+	 (!makeDir(hwmon+"hwmon0")) || (!makeDir(hwmon+"hwmon1")) || (!makeDir(thermal+"thermal_zone0")) )
+      return false;
+
+    writeFile(hwmon+"hwmon0/name", "coretemp\n");
+    for (unsigned i=1; i<=5; ++i)
+      {
+	string temp = hwmon+"hwmon0/temp"+to_string(i);
+	writeFile(temp+"_label", (i==1)?"Package id 0\n":"Core "+to_string(i-2)+"\n");
+	writeFile(temp+"_input", to_string(35000+rnd(40000))+"\n");
+      }
+    writeFile(hwmon+"hwmon1/name", "nct6775\n");
+    writeFile(hwmon+"hwmon1/fan1_input", to_string(600+rnd(1400))+"\n");
+    writeFile(hwmon+"hwmon1/fan2_input", to_string(600+rnd(1400))+"\n");
+    writeFile(hwmon+"hwmon1/power1_input", to_string(20000000+rnd(100000000))+"\n");
+    writeFile(thermal+"thermal_zone0/type", "x86_pkg_temp\n");
+    return writeFile(thermal+"thermal_zone0/temp", to_string(35000+rnd(40000))+"\n");
+  }
+
+  /** Writes a full stat line (52 fields) as the kernel does  */
+  bool writeStat(string dir, unsigned pid)
+  {
+    char line[1024];
+    const char *name = names[rnd(sizeof(names)/sizeof(names[0]))];
+    writeFile(dir+"/cgroup", "0::"+serviceName(name)+"\n");
+    unsigned long long starttime = (unsigned long long)rnd((unsigned)(uptimeSecs*100));
+    unsigned long long utime = rnd(100000), stime = rnd(20000);
+    unsigned long vsize = (unsigned long)(rnd(4096)+1) * 1024 * 1024;
+    long rss = rnd(vsize / 4096 / 2);
+
+    snprintf(line, 1024,
+	     "%u (%s) %c %u %u %u %u %d %u %lu %lu %lu %lu "
+	     "%llu %llu %llu %llu "
+	     "%ld %ld %u %ld %llu %lu %ld "
+	     "18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 %u 0 0 %u 0 0 0 0 0 0 0 0 0 0\n",
+	     pid, name, states[rnd(sizeof(states)-1)],
+	     (pid>1)?rnd(pid-1)+1:0, pid, pid, (rnd(4)==0)?34816+rnd(8):0, -1,
+	     4194560u, (unsigned long)rnd(1000000), 0ul, (unsigned long)rnd(1000), 0ul,
+	     utime, stime, 0ull, 0ull,
+	     20l, (long)rnd(20)-(long)rnd(20)/2, rnd(32)+1, 0l,
+	     starttime, vsize, rss,
+	     rnd(8), rnd(100));
+
+    if (!writeFile(dir+"/stat", line))
+      return false;
+
+    /* Same CPU time in ns (at 100 Hz), and some run queue waiting */
+    snprintf(line, 1024, "%llu %llu %u\n", (utime+stime)*10000000ull, (unsigned long long)rnd(1000000)*1000, rnd(100000));
+    writeFile(dir+"/schedstat", line);
+
+    /* Forks share lots of memory */
+    unsigned long rssKb = rss*4, shared = rnd(rssKb+1), swap = rnd(1024);
+    snprintf(line, 1024,
+	     "00400000-7fffffffe000 ---p 00000000 00:00 0                          [rollup]\n"
+	     "Rss:            %8lu kB\nPss:            %8lu kB\nShared_Clean:   %8lu kB\n"
+	     "Shared_Dirty:          0 kB\nPrivate_Clean:  %8lu kB\nPrivate_Dirty:  %8lu kB\n"
+	     "Referenced:     %8lu kB\nAnonymous:      %8lu kB\nSwap:           %8lu kB\nSwapPss:        %8lu kB\n",
+	     rssKb, rssKb-shared+shared/(rnd(8)+1), shared, (rssKb-shared)/2, rssKb-shared-(rssKb-shared)/2,
+	     rssKb, rssKb-shared, swap, swap);
+    return writeFile(dir+"/smaps_rollup", line);
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+    {
+      fprintf(stderr, "Usage: %s <directory> <processes> [mounts=16] [seed=1]\n", argv[0]);
+      return 1;
+    }
+
+  string root = argv[1];
+  unsigned nprocs = atoi(argv[2]);
+  unsigned nmounts = (argc>3)?atoi(argv[3]):16;
+  lcgState = (argc>4)?strtoull(argv[4], NULL, 10):1;
+
+  if ( (!makeDir(root)) || (!makeDir(root+"/proc")) || (!makeDir(root+"/mnt")) ||
+       (!makeDir(root+"/cgroup")) || (!makeDir(root+"/cgroup/system.slice")) )
+    {
+      perror("Can't create directories");
+      return 2;
+    }
+
+  writeFile(root+"/cgroup/cgroup.controllers", "cpu io memory pids\n");
+  if ( (!writeTopology(root)) || (!writeSensors(root)) )
+    {
+      perror("Can't create sysfs tree");
+      return 2;
+    }
+  for (const char* name : names)
+    writeCgroup(root+"/cgroup", serviceName(name));
+
+  char uptime[64];
+  snprintf(uptime, 64, "%.2f %.2f\n", uptimeSecs, uptimeSecs*3.5);
+  writeFile(root+"/proc/uptime", uptime);
+
+  /* pids won't be consecutive, as in real life */
+  unsigned pid = 1, lastpid = 0;
+  for (unsigned i=0; i<nprocs; ++i)
+    {
+      lastpid = pid;
+      string dir = root+"/proc/"+to_string(pid);
+      if ( (!makeDir(dir)) || (!writeStat(dir, pid)) )
+	{
+	  perror(dir.c_str());
+	  return 3;
+	}
+      pid+=rnd(3)+1;
+    }
+
+  string mtab;
+  for (unsigned i=0; i<nmounts; ++i)
+    {
+      string mnt = root+"/mnt/"+to_string(i);
+      makeDir(mnt);
+      mtab+="/dev/fake"+to_string(i)+" "+mnt+" ext4 rw,relatime 0 0\n";
+    }
+  writeFile(root+"/mtab", mtab);
+
+  printf("%u processes (last pid %u) and %u mount points created in %s\n", nprocs, lastpid, nmounts, root.c_str());
+  return 0;
+}
@@ -48,6 +48,8 @@ int main(int argc, char *argv[])
   cout << " * Total threads: "<<Umon::totalThreads()<<endl;
   cout << " * System load: "<<Umon::sysload1u()<<" "<<Umon::sysload5u()<<" "<<Umon::sysload15u()<<endl;
   cout << " * System load: "<<Umon::sysload1()<<" "<<Umon::sysload5()<<" "<<Umon::sysload15()<<endl;
+  cout << " * CPU pressure (some): "<<Umon::cpuPressure().some.avg10<<" "<<Umon::cpuPressure().some.avg60<<" "<<Umon::cpuPressure().some.avg300<<endl;
+  cout << " * Memory pressure (full): "<<Umon::memoryPressure().full.avg10<<" "<<Umon::memoryPressure().full.avg60<<" "<<Umon::memoryPressure().full.avg300<<endl;
   cout << "system configuration information: "<<endl;
   cout << " * Max argument length: "<<Umon::maxArgumentsLength()<<endl;
   cout << " * Max processes per user: "<<Umon::maxProcessesPerUser()<<endl;
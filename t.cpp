@@ -0,0 +1,14 @@
+#include "umon.h"
+#include <iostream>
+#include <dirent.h>
+static int threads(){ int n=0; DIR* d=opendir("/proc/self/task"); while (auto e=readdir(d)) if (e->d_name[0]!='.') ++n; closedir(d); return n; }
+int main(){
+  Umon::mountWaiting(0.05);
+  int fd=Umon::Async::fd();
+  for (int r=0;r<10;++r){
+    bool finished=false;
+    Umon::Async::refresh(Umon::REFRESH_MOUNTS, [&](){ finished=true; });
+    while (!finished){ struct pollfd p={fd,POLLIN,0}; poll(&p,1,1000); Umon::Async::step(); }
+  }
+  std::cout<<"threads after 10 refreshes: "<<threads()<<" timeouts="<<Umon::statsCounters().timeouts<<" cancellations="<<Umon::statsCounters().cancellations<<std::endl;
+}
@@ -52,6 +52,30 @@
 * 20141222: processes information
 * 20141224: some doc and githubbing !!
 * 20150320: Made functions static
+* 20261018: configurable /proc root and mtab file (for synthetic trees and benchmarks)
+* 20261018: self-instrumentation: per-stage latency histograms and counters (Umon::Stats)
+* 20261018: cgroup v2 CPU, memory and I/O accounting (Umon::Cgroup)
+* 20261018: Pressure Stall Information and PSI triggers
+* 20261018: refresh hooks and threshold alert engine (Umon::Alerts)
+* 20261018: watch lists: refresh just some processes, exits detected with pidfds (Umon::Watch)
+* 20261018: PSS, USS and swap per process from smaps_rollup, with a time budget
+* 20261018: incremental, time-budgeted process scanning (Proc::scanStep())
+* 20261018: optional io_uring backend to read /proc/<pid>/stat files in batches
+* 20261018: metric history recorder and reader (mmap'd ring file)
+* 20261018: CPU and NUMA topology, node memory, process last CPU and node
+* 20261018: hardware sensors (hwmon and thermal zones) with opened files
+* 20261018: process state constants, uid, and indexes by state, uid, tty, session and pgrp
+* 20261018: process events (started, exited, changed) queued while scanning
+* 20261018: process metric columns, filter and aggregate kernels with selection bitmaps
+* 20261018: non-blocking collection for event loops (Async), statfs() threads don't use freed memory
+* 20261018: compile-time collectors (just the fields asked for), UMON_NO_THREADS
+* 20261018: nanosecond %CPU and run queue waiting from schedstat, %CPU uses ticksPerSecond()
+* 20261018: TCP and UDP sockets from netlink sock_diag, counted by state, local port and process (Umon::Sockets)
+* 20261018: open files per process, RLIMIT_NOFILE usage and fd growth (Proc::openFiles())
+* 20261018: fixed capacity collection with no allocations after init (Umon::Fixed), Collector capacity
+* 20261018: state shared by all translation units (one cache and one scan), UMON_PRIVATE_STATE
+* 20261018: per-process delay accounting (CPU, block I/O, swap in, reclaim) from taskstats (Umon::Taskstats)
+* 20261018: process groups by PID namespace, cgroup or container, with totals kept while scanning
 *
 * Bugs:
 * 20141219: Sometimes received SIGABRT when loading mounts information. FIXED 20141220
@@ -60,11 +84,8 @@
 *  - Have process start time in chrono::time_point
 *  - Insert cmdline into process information
 *  - Insert OOM information into process struct
-*  - Process state constants (R, S, Z...)
-*  - List processes by state
 *  - Folder size counter
 *  - Network device detection
-*  - Temperature fetch
 *
 * Useful stuff for future features:
 * * doc for proc: http://man7.org/linux/man-pages/man5/proc.5.html (better than my man proc)
@@ -99,21 +120,101 @@
 #include <unistd.h>
 #include <vector>
 #include <map>
+#include <set>
 #include <mntent.h>
-#include <mutex>
+#ifndef UMON_NO_THREADS
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 #include <sys/vfs.h>
 #include <functional>
 #include <fcntl.h>
 #include <sys/dir.h>
+#include <climits>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <cmath>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <type_traits>
+#include <memory>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include <unordered_set>
+#include <unordered_map>
+
+/* io_uring is used with raw syscalls (no liburing), we just need kernel headers.
+   Define UMON_NO_IO_URING to leave it out. */
+#if !defined(UMON_NO_IO_URING) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    define UMON_IO_URING 1
+#    ifndef SYS_io_uring_setup
+#      define SYS_io_uring_setup 425
+#    endif
+#    ifndef SYS_io_uring_enter
+#      define SYS_io_uring_enter 426
+#    endif
+#  endif
+#endif
+
+/* Some types (statfs() jobs, io_uring batches) change with UMON_NO_THREADS and
+   UMON_NO_IO_URING: the library is in an inline namespace named after them, so files
+   built with other options have other types and state instead of sharing one object
+   with two layouts. */
+#ifdef UMON_NO_THREADS
+#  define UMON_CONFIG_THREADS nothreads
+#else
+#  define UMON_CONFIG_THREADS threads
+#endif
+#ifdef UMON_IO_URING
+#  define UMON_CONFIG_URING _uring
+#else
+#  define UMON_CONFIG_URING _nouring
+#endif
+#define UMON_CONFIG_NAME2(threads, uring) config_##threads##uring
+#define UMON_CONFIG_NAME(threads, uring) UMON_CONFIG_NAME2(threads, uring)
 
 namespace Umon
 {
-
-  /* private helper variables and stuff*/
+#ifdef UMON_PRIVATE_STATE
+  /* The whole library is private to this translation unit: its state, and classes
+     and templates too, as their code uses it. Nothing is mixed with the shared
+     one of files not defining UMON_PRIVATE_STATE. */
   namespace
+  {
+#endif
+  inline namespace UMON_CONFIG_NAME(UMON_CONFIG_THREADS, UMON_CONFIG_URING)
+  {
+
+  namespace Internal
+  {
+    /** Library state is shared by every translation unit including umon.h: template
+	static members are defined here and the linker keeps just one of each (as C++17
+	inline variables). With UMON_PRIVATE_STATE each translation unit has its own. */
+    template <typename T>
+    struct Shared
+    {
+      static T value;
+    };
+
+    template <typename T> T Shared<T>::value;
+
+    /** Settings and process scanning variables (internal use) */
+    struct Globals_t
     {
-      /* Variables */
       int8_t _sizePrecission = 3;
 
       /* Values will be fetched from a variable if calls are too close in time */
@@ -121,29 +222,78 @@ namespace Umon
       std::chrono::steady_clock::duration _mountWaiting = std::chrono::milliseconds(1000);
       unsigned _valueCheckInterval = 200;
 
+      /* Where to look for system files. They can point to a synthetic tree
+	 (see procgen.cpp) to test or benchmark without a real system. */
+      std::string _procRoot = "/proc";
+      std::string _mtabFile = "/etc/mtab";
+      std::string _cgroupRoot = "/sys/fs/cgroup";
+      std::string _sysRoot = "/sys";
+
       std::chrono::steady_clock::duration proccessSummaryRebuild = std::chrono::milliseconds(1500);
       unsigned char lastProcessUpdate=0;
 
-      /* Rewriting try_lock_for method because of bugs in some compilers (gcc versions).
-         It does not wait for rel_time, just returns false. */
-      /* It can be a little quick and dirty but as a provisional fix, it seems to work */
-      class timed_mutex : public std::timed_mutex
-      {
-      public:
-	template <class Rep, class Period>
-	bool try_lock_for(const std::chrono::duration<Rep,Period>& rel_time)
-	{
-	  bool ok = false;
-	  unsigned count=0;
-	  std::chrono::duration<Rep,Period> sleep = rel_time/_valueCheckInterval;
-	  while (!(ok = (this->try_lock())) && (count++<_valueCheckInterval))
-	    {
-	      std::this_thread::sleep_for(sleep);
-	    }
-	  return ok;
-	}
-      };
+      /* PSS/USS/swap from smaps_rollup: expensive, so it's optional and budgeted */
+      bool _memoryDetails = false;
+      std::chrono::steady_clock::duration _memoryDetailsBudget = std::chrono::milliseconds(50);
+
+      /* Incremental scanning: idle processes are read again every _scanIdleInterval,
+	 processes over _scanActiveThreshold %CPU (and new ones) every pass */
+      std::chrono::steady_clock::duration _scanIdleInterval = std::chrono::seconds(5);
+      double _scanActiveThreshold = 1.0;
+
+      /* Read stat files in batches with io_uring (see Proc::ioUring()) */
+      bool _ioUring = false;
+
+      /* %CPU from /proc/<pid>/schedstat (ns) instead of stat (ticks) */
+      bool _schedstat = false;
+
+      /* Open files counted from /proc/<pid>/fd (see Proc::openFiles()) */
+      bool _openFiles = false;
+
+      /* Delay accounting from taskstats (see Proc::delays()) */
+      bool _delays = false;
 
+      /* Process groups kept while scanning (a Proc::Grouping, see Proc::grouping()) */
+      int _grouping = 0;
+
+      /* Process events (started, exited, changed) queued while scanning */
+      bool _procEvents = false;
+      double _eventPcpuThreshold = 5.0;	/* %CPU points */
+      long _eventRssThreshold = 256;	/* pages */
+      size_t _eventQueueLimit = 65536;
+      unsigned long _eventsDropped = 0;
+    };
+  };
+
+  /* private helper variables and stuff*/
+  namespace
+    {
+      /* Variables (references to the shared ones, see Internal::Shared) */
+      Internal::Globals_t& _globals = Internal::Shared<Internal::Globals_t>::value;
+      int8_t& _sizePrecission = _globals._sizePrecission;
+      std::chrono::steady_clock::duration& _valueDuration = _globals._valueDuration;
+      std::chrono::steady_clock::duration& _mountWaiting = _globals._mountWaiting;
+      unsigned& _valueCheckInterval = _globals._valueCheckInterval;
+      std::string& _procRoot = _globals._procRoot;
+      std::string& _mtabFile = _globals._mtabFile;
+      std::string& _cgroupRoot = _globals._cgroupRoot;
+      std::string& _sysRoot = _globals._sysRoot;
+      std::chrono::steady_clock::duration& proccessSummaryRebuild = _globals.proccessSummaryRebuild;
+      unsigned char& lastProcessUpdate = _globals.lastProcessUpdate;
+      bool& _memoryDetails = _globals._memoryDetails;
+      std::chrono::steady_clock::duration& _memoryDetailsBudget = _globals._memoryDetailsBudget;
+      std::chrono::steady_clock::duration& _scanIdleInterval = _globals._scanIdleInterval;
+      double& _scanActiveThreshold = _globals._scanActiveThreshold;
+      bool& _ioUring = _globals._ioUring;
+      bool& _schedstat = _globals._schedstat;
+      bool& _openFiles = _globals._openFiles;
+      bool& _delays = _globals._delays;
+      int& _grouping = _globals._grouping;
+      bool& _procEvents = _globals._procEvents;
+      double& _eventPcpuThreshold = _globals._eventPcpuThreshold;
+      long& _eventRssThreshold = _globals._eventRssThreshold;
+      size_t& _eventQueueLimit = _globals._eventQueueLimit;
+      unsigned long& _eventsDropped = _globals._eventsDropped;
     };
 
   /* Sysload as unsigned long values */
@@ -158,6 +308,29 @@ namespace Umon
     double one, five, fifteen;
   };
 
+  /* Pressure Stall Information resources */
+  enum PressureResource
+    {
+      PRESSURE_CPU,
+      PRESSURE_MEMORY,
+      PRESSURE_IO
+    };
+
+  /* A PSI line: % of time some (or all) tasks were stalled in last
+     10, 60 and 300 seconds, and total stall time in microseconds */
+  struct PressureLine
+  {
+    double avg10, avg60, avg300;
+    unsigned long long total;
+  };
+
+  /* PSI of a resource. full is always 0 for CPU in old kernels. */
+  struct Pressure
+  {
+    PressureLine some, full;
+    int error;			/* errno if PSI is not available */
+  };
+
   /* Mount points information */
   namespace Mounts
   {
@@ -214,6 +387,195 @@ namespace Umon
     typedef std::vector<MountPoint> MountPoints;
   };
 
+  /* Self instrumentation. What are we spending our time in? */
+  namespace Stats
+  {
+    /** Refresh stages we measure. Process stages (read, parse, update) are
+	measured on a sample of processes (see sampleRate()) and scaled, so
+	measuring doesn't cost much more than the work itself. */
+    enum Stage
+      {
+	SYSINFO,		/* sysinfo() call */
+	MOUNTS,			/* whole mountsInfo() refresh */
+	MOUNTS_MTAB,		/* reading mtab entries */
+	MOUNTS_STATFS,		/* statfs() on each mount point (one value per mount) */
+	PROC,			/* whole buildProcSummary() refresh */
+	PROC_READDIR,		/* reading /proc directory entries */
+	PROC_READ,		/* reading /proc/<pid>/stat files */
+	PROC_PARSE,		/* parsing them */
+	PROC_UPDATE,		/* updating process map and %CPU */
+	PROC_CLEANUP,		/* removing finished processes */
+	PROC_ADVANCED,		/* buildAdvancedSummary() grouping */
+	PROC_SMAPS,		/* reading smaps_rollup files */
+	PROC_STEP,		/* each scanStep() call */
+	PROC_FDS,		/* counting open files (openFiles()) */
+	PROC_DELAYS,		/* taskstats delays (delays()) */
+	CGROUP,			/* cgroup files refresh (one value per cgroup) */
+	HISTORY,		/* writing a history record */
+	SENSORS,		/* reading all sensors */
+	SOCKETS,		/* Sockets::count() */
+	STAGE_COUNT
+      };
+
+    /** Latency histogram in nanoseconds. Each power of two [2^e, 2^(e+1)) is
+	split in SUB linear sub-buckets, so a bucket is 1/SUB of its values wide
+	(values < SUB have their own bucket) */
+    struct Histogram
+    {
+      enum { SUB_BITS = 3, SUB = 1<<SUB_BITS, BUCKETS = (64-SUB_BITS+1)*SUB };
+      uint64_t buckets[BUCKETS];
+      uint64_t count, sum, min, max;
+
+      static unsigned bucket(uint64_t ns)
+      {
+	if (ns < SUB)
+	  return ns;
+	unsigned e = 63-__builtin_clzll(ns);
+	return (e-SUB_BITS+1)*SUB + ((ns >> (e-SUB_BITS)) & (SUB-1));
+      }
+
+      /** Lowest value in bucket b  */
+      static uint64_t bucketLow(unsigned b)
+      {
+	return (b < SUB)?b:(uint64_t)(SUB + b%SUB) << (b/SUB-1);
+      }
+
+      /** Bucket b width  */
+      static uint64_t bucketWidth(unsigned b)
+      {
+	return (b < SUB)?1:1ULL << (b/SUB-1);
+      }
+
+      void record(uint64_t ns)
+      {
+	++buckets[bucket(ns)];
+	++count;
+	sum+=ns;
+	if ( (count==1) || (ns<min) )
+	  min = ns;
+	if (ns>max)
+	  max = ns;
+      }
+
+      /** Mean value in seconds  */
+      double mean()
+      {
+	return (count)?(double)sum/count/1e9:0;
+      }
+
+      /** Approximate percentile (0-1) in seconds, interpolated inside its bucket  */
+      double percentile(double p)
+      {
+	if (!count)
+	  return 0;
+	double target = std::max(1.0, p * count), acc=0;
+	for (unsigned i=0; i<BUCKETS; ++i)
+	  {
+	    if ( (!buckets[i]) || (acc+buckets[i] < target) )
+	      {
+		acc+=buckets[i];
+		continue;
+	      }
+	    double value = bucketLow(i) + bucketWidth(i) * (target-acc) / buckets[i];
+	    return std::max((double)min, std::min((double)max, value))/1e9;
+	  }
+	return (double)max/1e9;
+      }
+    };
+
+    /** Library-wide counters */
+    struct Counters
+    {
+      uint64_t
+      syscalls,			/* syscalls made by the library (known call sites) */
+	bytesRead,		/* bytes read from files */
+	allocations,		/* heap allocations (known call sites, approximate) */
+	timeouts,		/* mount points not responding in time */
+	cancellations,		/* statfs() threads cancelled */
+	refreshes;		/* sysinfo, mounts or processes refreshes */
+    };
+  };
+
+  /* Refreshes we can be notified about */
+  enum RefreshKind
+    {
+      REFRESH_SYSINFO,
+      REFRESH_MOUNTS,
+      REFRESH_PROC
+    };
+
+  namespace Internal
+  {
+    /** Functions called after each refresh (see onRefresh()) */
+    struct RefreshHooks_t
+    {
+      std::map<unsigned, std::function<void(RefreshKind)> > hooks;
+      unsigned id = 0;
+      bool inHook = false;
+    };
+
+    /** Self instrumentation (see Stats) */
+    struct StatsState_t
+    {
+      bool enabled = true;
+      unsigned sampleRate = 16;
+      Stats::Histogram histograms[Stats::STAGE_COUNT];
+      Stats::Counters counters;
+      /* Process stages time accumulated in the current refresh: one for
+	 buildProcSummary() and one for scanStep() passes, scanTime is the
+	 one in use */
+      uint64_t buildTime[Stats::STAGE_COUNT];
+      uint64_t stepTime[Stats::STAGE_COUNT];
+      uint64_t* scanTime = buildTime;
+      unsigned scanTick = 0;
+    };
+  };
+
+  namespace
+    {
+      Internal::RefreshHooks_t& RefreshHooks = Internal::Shared<Internal::RefreshHooks_t>::value;
+      auto& _refreshHooks = RefreshHooks.hooks;
+      unsigned& _refreshHookId = RefreshHooks.id;
+      bool& _inRefreshHook = RefreshHooks.inHook;
+
+      /** Call refresh hooks. Refreshes made from a hook won't call hooks again */
+      void notifyRefresh(RefreshKind kind)
+      {
+	if ( (_refreshHooks.empty()) || (_inRefreshHook) )
+	  return;
+
+	_inRefreshHook = true;
+	for (auto h : _refreshHooks)
+	  h.second(kind);
+	_inRefreshHook = false;
+      }
+
+      Internal::StatsState_t& StatsState = Internal::Shared<Internal::StatsState_t>::value;
+      bool& _statsEnabled = StatsState.enabled;
+      unsigned& _statsSampleRate = StatsState.sampleRate;
+      auto& _statsHistograms = StatsState.histograms;
+      Stats::Counters& _statsCounters = StatsState.counters;
+      uint64_t*& _statsScanTime = StatsState.scanTime;
+      unsigned& _statsScanTick = StatsState.scanTick;
+
+      inline uint64_t statsNow()
+      {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+      }
+
+      inline void statsRecord(Stats::Stage stage, uint64_t ns)
+      {
+	if (_statsEnabled)
+	  _statsHistograms[stage].record(ns);
+      }
+
+      /** Should we measure this process? */
+      inline bool statsSampleThis()
+      {
+	return (_statsEnabled) && ((_statsScanTick++ % _statsSampleRate) == 0);
+      }
+    };
+
   /* Some getters/setters */
 
   /** get size precission (to use with @see size() ) */
@@ -253,7 +615,8 @@ namespace Umon
     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(_mountWaiting).count();
   }
 
-  /* value check interval getter/s */
+  /** Deprecated: the value is stored but ignored (statfs() threads are waited
+      with a condition variable, there's nothing to poll). Kept so old code builds */
   static unsigned valueCheckInterval()
   {
     return _valueCheckInterval;
@@ -267,6 +630,68 @@ namespace Umon
     return _valueCheckInterval;
   }
 
+  /* proc filesystem root getter/s */
+  static std::string procRoot()
+  {
+    return _procRoot;
+  }
+
+  static std::string procRoot(std::string val)
+  {
+    _procRoot = val;
+    return _procRoot;
+  }
+
+  /* mtab file getter/s */
+  static std::string mtabFile()
+  {
+    return _mtabFile;
+  }
+
+  static std::string mtabFile(std::string val)
+  {
+    _mtabFile = val;
+    return _mtabFile;
+  }
+
+  /* cgroup filesystem root getter/s */
+  static std::string cgroupRoot()
+  {
+    return _cgroupRoot;
+  }
+
+  static std::string cgroupRoot(std::string val)
+  {
+    _cgroupRoot = val;
+    return _cgroupRoot;
+  }
+
+  /* sysfs root getter/s (topology and sensors) */
+  static std::string sysRoot()
+  {
+    return _sysRoot;
+  }
+
+  static std::string sysRoot(std::string val)
+  {
+    _sysRoot = val;
+    return _sysRoot;
+  }
+
+  /** Calls f each time sysinfo, mount points or processes are refreshed. Returns
+      an id to remove the hook. Refreshes made inside a hook won't call hooks. */
+  static unsigned onRefresh(std::function<void(RefreshKind)> f)
+  {
+    _refreshHooks[++_refreshHookId] = f;
+    return _refreshHookId;
+  }
+
+  /** Removes a refresh hook  */
+  static void removeRefreshHook(unsigned id)
+  {
+    _refreshHooks.erase(id);
+  }
+
   /** Humanize size */
   static std::string size(long double size, int8_t precission=-1)
   {
@@ -296,32 +721,113 @@ namespace Umon
     int fd = open(filename, O_RDONLY);
     std::string output;
 
+    ++_statsCounters.syscalls;
     if (fd==-1)
       return "";		/* error opening */
 
     char *buffer = (char*)malloc(bufferSize);
+    ++_statsCounters.allocations;
     if (buffer==NULL)
-      return "";		/* Can't allocate memory */
+      {
+	close(fd);
+	return "";		/* Can't allocate memory */
+      }
 
     int datalength;
     while ((datalength = read(fd, buffer, bufferSize)) > 0)
-      output.append(buffer, datalength);
+      {
+	if (output.capacity() < output.size() + datalength)
+	  ++_statsCounters.allocations;
+	output.append(buffer, datalength);
+	_statsCounters.bytesRead+=datalength;
+	++_statsCounters.syscalls;
+      }
 
+    free(buffer);
     close(fd);
+    _statsCounters.syscalls+=2;	/* last read() and close() */
     return output;
   }
 
+  /** Reads a file we keep opened into a buffer. Returns bytes read or -1.
+      Buffer will always be NULL-terminated. */
+  static ssize_t readOpenedFile(int fd, char* buffer, size_t bufferSize)
+  {
+    ssize_t res = pread(fd, buffer, bufferSize-1, 0);
+    ++_statsCounters.syscalls;
+    if (res<0)
+      res = 0;
+    buffer[res] = '\0';
+    _statsCounters.bytesRead+=res;
+    return res;
+  }
+
+  namespace
+    {
+      /** Parse "key value" lines getting just the keys we want in one pass  */
+      void parseKeyValues(const char* data, const char* const keys[], uint64_t* const values[], unsigned nkeys)
+      {
+	while (*data)
+	  {
+	    const char* space = strchr(data, ' ');
+	    const char* eol = strchr(data, '\n');
+	    if (space == NULL)
+	      break;
+	    if (eol == NULL)
+	      eol = data+strlen(data);
+
+	    size_t keylen = space - data;
+	    for (unsigned i=0; i<nkeys; ++i)
+	      if ( (strncmp(data, keys[i], keylen)==0) && (keys[i][keylen]=='\0') )
+		{
+		  *values[i] = strtoull(space+1, NULL, 10);
+		  break;
+		}
+	    data = (*eol)?eol+1:eol;
+	  }
+      }
+    };
+
+  namespace Internal
+  {
+    /** Cached values of sysinfo, uptime and pressure (internal use)  */
+    struct SystemCache_t
+    {
+      struct sysinfo sysinfo;
+      std::chrono::steady_clock::time_point sysinfoTp; /* last sysinfo fetched */
+      long fileUptime;		/* cached value read from file */
+      std::chrono::steady_clock::time_point uptimeTp;
+      double fileBootTime;		/* <procRoot>/uptime with fractions (bootTime()) */
+      std::chrono::steady_clock::time_point bootTimeTp;
+      std::string bootTimeRoot;	/* procRoot() it was read from */
+      Pressure pressure[3];
+      int pressurefd[3] = { -1, -1, -1 };
+      std::string pressureRoot;	/* procRoot() when files were opened */
+      std::chrono::steady_clock::time_point pressureTp[3];
+    };
+  };
+
+  namespace
+    {
+      Internal::SystemCache_t& SystemCache = Internal::Shared<Internal::SystemCache_t>::value;
+    };
+
   /* Linux specific routines */
   /** get basic sysinfo (ram, swap, uptime, sysload...)  */
   static struct sysinfo getSysInfo(bool reload=false)
   {
-    static struct sysinfo _sysinfo;		/* sysinfo cached value */
-    static std::chrono::steady_clock::time_point _sysinfo_tp; /* last sysinfo fetched */
+    struct sysinfo& _sysinfo = SystemCache.sysinfo;
+    auto& _sysinfo_tp = SystemCache.sysinfoTp;
 
     if ( (reload) || (_sysinfo_tp+_valueDuration < std::chrono::steady_clock::now()) )
       {
+	uint64_t start = statsNow();
 	sysinfo(&_sysinfo);
       	_sysinfo_tp = std::chrono::steady_clock::now();
+	++_statsCounters.syscalls;
+	++_statsCounters.refreshes;
+	statsRecord(Stats::SYSINFO, statsNow()-start);
+	notifyRefresh(REFRESH_SYSINFO);
       }
 
     return _sysinfo;
@@ -412,17 +918,26 @@ namespace Umon
     return getSysInfo().mem_unit;
   }
 
-  /** gets uptime via sysinfo or via /proc/uptime (more portable to other unixes)  */
+  /** gets uptime via sysinfo or via /proc/uptime (more portable to other unixes).
+      If procRoot() was changed, uptime file will be read from there, so process
+      times are consistent with the tree we are reading. */
   static long uptime()
   {
-    long tmp = getSysInfo().uptime;
+    long& _fileUptime = SystemCache.fileUptime;
+    auto& _uptime_tp = SystemCache.uptimeTp;
+
+    long tmp = (_procRoot == "/proc")?getSysInfo().uptime:0;
     if (!tmp)
       {
+	if (_uptime_tp+_valueDuration >= std::chrono::steady_clock::now())
+	  return _fileUptime;
+
 	/* Extract uptime the old way */
-	std::string data = extractFile("/proc/uptime", 32);
-	double rawdata;
+	std::string data = extractFile((_procRoot+"/uptime").c_str(), 32);
+	double rawdata = 0;
 	sscanf(data.c_str(), "%lf", &rawdata);
-	tmp = (long)rawdata;
+	tmp = _fileUptime = (long)rawdata;
+	_uptime_tp = std::chrono::steady_clock::now();
       }
     return tmp;
   }
@@ -485,6 +1000,219 @@ namespace Umon
     return getSysInfo().procs;
   }
 
+  /** PSI file name for a resource */
+  static const char* pressureFileName(PressureResource res)
+  {
+    static const char* names[3] = { "cpu", "memory", "io" };
+    return names[res];
+  }
+
+  /** Parses a PSI file contents */
+  static Pressure parsePressure(const char* data)
+  {
+    Pressure p = {{0,0,0,0}, {0,0,0,0}, 0};
+    const char* full = strstr(data, "full ");
+    if (sscanf(data, "some avg10=%lf avg60=%lf avg300=%lf total=%llu",
+	       &p.some.avg10, &p.some.avg60, &p.some.avg300, &p.some.total) != 4)
+      p.error = EINVAL;
+    if (full != NULL)
+      sscanf(full, "full avg10=%lf avg60=%lf avg300=%lf total=%llu",
+	     &p.full.avg10, &p.full.avg60, &p.full.avg300, &p.full.total);
+    return p;
+  }
+
+  /** gets Pressure Stall Information of a resource. PSI files are kept opened. */
+  static Pressure getPressure(PressureResource res, bool reload=false)
+  {
+    auto& _pressure = SystemCache.pressure;
+    auto& _pressurefd = SystemCache.pressurefd;
+    std::string& _pressureRoot = SystemCache.pressureRoot;
+    auto& _pressure_tp = SystemCache.pressureTp;
+
+    if (_pressureRoot != _procRoot)
+      {
+	for (int i=0; i<3; ++i)
+	  if (_pressurefd[i] != -1)
+	    {
+	      close(_pressurefd[i]);
+	      _pressurefd[i] = -1;
+	    }
+	_pressureRoot = _procRoot;
+	reload = true;
+      }
+
+    if ( (reload) || (_pressure_tp[res]+_valueDuration < std::chrono::steady_clock::now()) )
+      {
+	char buffer[256];
+	if (_pressurefd[res] == -1)
+	  {
+	    _pressurefd[res] = open((_procRoot+"/pressure/"+pressureFileName(res)).c_str(), O_RDONLY | O_CLOEXEC);
+	    ++_statsCounters.syscalls;
+	  }
+	if (_pressurefd[res] == -1)
+	  {
+	    _pressure[res] = Pressure({{0,0,0,0}, {0,0,0,0}, errno});
+	  }
+	else
+	  {
+	    readOpenedFile(_pressurefd[res], buffer, sizeof(buffer));
+	    _pressure[res] = parsePressure(buffer);
+	  }
+	_pressure_tp[res] = std::chrono::steady_clock::now();
+      }
+
+    return _pressure[res];
+  }
+
+  /** gets CPU pressure  */
+  static Pressure cpuPressure()
+  {
+    return getPressure(PRESSURE_CPU);
+  }
+
+  /** gets memory pressure  */
+  static Pressure memoryPressure()
+  {
+    return getPressure(PRESSURE_MEMORY);
+  }
+
+  /** gets I/O pressure  */
+  static Pressure ioPressure()
+  {
+    return getPressure(PRESSURE_IO);
+  }
+
+  /** PSI trigger. The kernel will wake us up when tasks are stalled for more
+      than stall microseconds in a window (also in microseconds, 500ms to 10s,
+      multiple of 2s for unprivileged users in newer kernels). So we can sleep
+      until there is a problem instead of polling.
+      e.g:
+	Umon::PressureTrigger t;
+	t.open(Umon::PRESSURE_MEMORY, false, 150000, 1000000);
+	while (t.wait(-1) > 0)
+	  std::cout << "Memory stall!" << std::endl; */
+  class PressureTrigger
+  {
+  public:
+    PressureTrigger(): _fd(-1), _error(0)
+    {
+    }
+
+    ~PressureTrigger()
+    {
+      close();
+    }
+
+    PressureTrigger(const PressureTrigger&) = delete;
+    PressureTrigger& operator=(const PressureTrigger&) = delete;
+
+    /** System-wide trigger. If full is true, all non-idle tasks must be stalled */
+    bool open(PressureResource res, bool full, unsigned long stallUs, unsigned long windowUs)
+    {
+      return openFile(_procRoot+"/pressure/"+pressureFileName(res), full, stallUs, windowUs);
+    }
+
+    /** Trigger for a cgroup (path relative to cgroupRoot())  */
+    bool openCgroup(std::string path, PressureResource res, bool full, unsigned long stallUs, unsigned long windowUs);
+
+    /** Trigger on any PSI file */
+    bool openFile(std::string filename, bool full, unsigned long stallUs, unsigned long windowUs)
+    {
+      char trigger[64];
+      close();
+      _fd = ::open(filename.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+      ++_statsCounters.syscalls;
+      if (_fd == -1)
+	{
+	  _error = errno;
+	  return false;
+	}
+      snprintf(trigger, 64, "%s %lu %lu", (full)?"full":"some", stallUs, windowUs);
+      /* Kernel wants the NULL terminator too */
+      ++_statsCounters.syscalls;
+      if (write(_fd, trigger, strlen(trigger)+1) < 0)
+	{
+	  _error = errno;
+	  close();
+	  return false;
+	}
+      _error = 0;
+      return true;
+    }
+
+    /** Waits for the trigger. Returns 1 if triggered, 0 on timeout, -1 on error.
+	timeout in milliseconds (-1 = forever) */
+    int wait(int timeoutMs)
+    {
+      if (_fd == -1)
+	return -1;
+
+      struct pollfd pfd = { _fd, POLLPRI, 0 };
+      int res = poll(&pfd, 1, timeoutMs);
+      ++_statsCounters.syscalls;
+      if (res < 0)
+	{
+	  _error = errno;
+	  return -1;
+	}
+      if ( (res>0) && (pfd.revents & POLLERR) )
+	{
+	  _error = ENODEV;	/* monitored cgroup was removed */
+	  return -1;
+	}
+      return (res>0)?1:0;
+    }
+
+    /** To watch it in our own poll/epoll loop (POLLPRI / EPOLLPRI) */
+    int fd()
+    {
+      return _fd;
+    }
+
+    /** Last error (errno)  */
+    int error()
+    {
+      return _error;
+    }
+
+    void close()
+    {
+      if (_fd != -1)
+	{
+	  ::close(_fd);
+	  ++_statsCounters.syscalls;
+	}
+      _fd = -1;
+    }
+
+  private:
+    int _fd;
+    int _error;
+  };
+
+  /** Waits for several triggers at once. Returns the index of the first one
+      triggered, -1 on timeout and -2 on error. */
+  static int waitPressure(std::vector<PressureTrigger*> triggers, int timeoutMs)
+  {
+    std::vector<struct pollfd> pfds;
+    for (auto t : triggers)
+      pfds.push_back({t->fd(), POLLPRI, 0});
+
+    int res = poll(pfds.data(), pfds.size(), timeoutMs);
+    ++_statsCounters.syscalls;
+    if (res < 0)
+      return -2;
+
+    for (unsigned i=0; i<pfds.size(); ++i)
+      {
+	if (pfds[i].revents & POLLERR)
+	  return -2;
+	if (pfds[i].revents & POLLPRI)
+	  return i;
+      }
+    return -1;
+  }
+
   /* System configuration */
   /** gets max arguments length  */
   static long maxArgumentsLength()
@@ -542,82 +1270,781 @@ namespace Umon
     return sysconf(_SC_NPROCESSORS_ONLN);
   }
 
-  /** Mount point related stuff  */
-  namespace Mounts
+  /** CPU and NUMA topology. Static topology is loaded once (see reload()),
+      node memory and NUMA counters are refreshed. */
+  namespace Topology
   {
-    /** Gets all mount points information  */
-    static MountPoints mountsInfo(bool reload=false)
+    /** A logical CPU and where it is  */
+    struct Cpu
     {
-      static MountPoints res;
-      static std::chrono::steady_clock::time_point _mpinfo_tp; /* last mounts info fetched */
-
-      if ( (!reload) && (_mpinfo_tp+_valueDuration >= std::chrono::steady_clock::now()) )
-	return res;
+      unsigned id;
+      int core;			/* core id (in its package), -1 if unknown */
+      int package;		/* physical package (socket), -1 if unknown */
+      int node;			/* NUMA node, -1 if unknown */
+      bool online;
+    };
 
-      res.clear();
+    /** A NUMA node and its CPUs  */
+    struct Node
+    {
+      unsigned id;
+      std::vector<unsigned> cpus;
+    };
 
-      struct mntent *ent;
-      struct statfs sfs;
-      FILE *fd = setmntent("/etc/mtab", "r");
+    /** Node memory (bytes, from node meminfo) and allocation counters (pages, from numastat) */
+    struct NodeStats
+    {
+      unsigned node;
+      int error;		/* errno if node files can't be read */
+      uint64_t
+      memTotal,
+	memFree,
+	memUsed,
+	filePages,
+	anonPages,
+	shmem,
+	slab;
+      uint64_t
+      numaHit,			/* allocated here as intended */
+	numaMiss,		/* allocated here, intended for other node */
+	numaForeign,		/* intended for here, allocated in other node */
+	interleaveHit,
+	localNode,		/* allocated here by a process running here */
+	otherNode;		/* allocated here by a process running in other node */
+    };
+  };
 
+  namespace Internal
+  {
+    /** Topology information (internal use) */
+    struct TopologySummary_t
+    {
+      bool loaded;
+      std::string root;	/* sysRoot() when loaded */
+      std::vector<Topology::Cpu> cpus;
+      std::vector<int> cpuNode;	/* node by cpu id */
+      std::vector<Topology::Node> nodes;
+      unsigned packages, cores;
+      /* Dynamic. Files kept opened */
+      std::vector<int> meminfofd, numastatfd;
+      std::vector<Topology::NodeStats> stats;
+      std::chrono::steady_clock::time_point tp;
+    };
+  };
+
+  namespace
+    {
+      Internal::TopologySummary_t& TopologySummary = Internal::Shared<Internal::TopologySummary_t>::value;
+
+      /** Parses a CPU or node list (e.g. 0-3,8-11)  */
+      std::vector<unsigned> parseCpuList(const char* list)
+      {
+	std::vector<unsigned> result;
+	while (*list)
+	  {
+	    char* end;
+	    unsigned long first = strtoul(list, &end, 10), last = first;
+	    if (end == list)
+	      break;
+	    if (*end == '-')
+	      last = strtoul(end+1, &end, 10);
+	    for (unsigned long i=first; i<=last; ++i)
+	      result.push_back(i);
+	    list = (*end == ',')?end+1:end;
+	  }
+	return result;
+      }
+
+      /** Reads a number from a sysfs file. def if we can't */
+      long readSysNumber(std::string filename, long def)
+      {
+	std::string data = extractFile(filename.c_str(), 64);
+	return (data.empty())?def:strtol(data.c_str(), NULL, 10);
+      }
+
+      void closeTopologyFiles()
+      {
+	auto& T = TopologySummary;
+	for (unsigned i=0; i<T.meminfofd.size(); ++i)
+	  {
+	    if (T.meminfofd[i] != -1)
+	      close(T.meminfofd[i]);
+	    if (T.numastatfd[i] != -1)
+	      close(T.numastatfd[i]);
+	  }
+	T.meminfofd.clear();
+	T.numastatfd.clear();
+      }
+
+      /** Loads static topology, if not loaded or sysRoot() changed */
+      void loadTopology(bool reload=false)
+      {
+	auto& T = TopologySummary;
+	if ( (T.loaded) && (!reload) && (T.root == _sysRoot) )
+	  return;
+
+	closeTopologyFiles();
+	T.root = _sysRoot;
+	T.cpus.clear();
+	T.nodes.clear();
+	T.stats.clear();
+	T.cpuNode.clear();
+	std::string cpuDir = _sysRoot+"/devices/system/cpu/";
+	std::string nodeDir = _sysRoot+"/devices/system/node/";
+	std::vector<unsigned> possible = parseCpuList(extractFile((cpuDir+"possible").c_str()).c_str());
+	std::vector<unsigned> online = parseCpuList(extractFile((cpuDir+"online").c_str()).c_str());
+	if (possible.empty())
+	  for (unsigned i=0; i<cpuCount(); ++i)
+	    possible.push_back(i);
+	if (online.empty())
+	  online = possible;
+
+	/* No NUMA (or no node info): one node with everything */
+	std::vector<unsigned> nodeIds = parseCpuList(extractFile((nodeDir+"online").c_str()).c_str());
+	for (auto n : nodeIds)
+	  {
+	    std::string list = extractFile((nodeDir+"node"+std::to_string(n)+"/cpulist").c_str());
+	    T.nodes.push_back(Topology::Node({n, parseCpuList(list.c_str())}));
+	  }
+	if (T.nodes.empty())
+	  T.nodes.push_back(Topology::Node({0, possible}));
+
+	T.cpuNode.assign((possible.empty())?0:possible.back()+1, -1);
+	for (auto& n : T.nodes)
+	  for (auto c : n.cpus)
+	    if (c < T.cpuNode.size())
+	      T.cpuNode[c] = n.id;
+
+	std::vector<std::pair<int,int>> cores;
+	std::vector<int> packages;
+	for (auto c : possible)
+	  {
+	    std::string dir = cpuDir+"cpu"+std::to_string(c)+"/topology/";
+	    Topology::Cpu cpu = { c, (int)readSysNumber(dir+"core_id", -1), (int)readSysNumber(dir+"physical_package_id", -1),
+				  T.cpuNode[c], std::find(online.begin(), online.end(), c) != online.end() };
+	    T.cpus.push_back(cpu);
+	    if (std::find(packages.begin(), packages.end(), cpu.package) == packages.end())
+	      packages.push_back(cpu.package);
+	    if (std::find(cores.begin(), cores.end(), std::make_pair(cpu.package, cpu.core)) == cores.end())
+	      cores.push_back(std::make_pair(cpu.package, cpu.core));
+	  }
+	T.packages = packages.size();
+	T.cores = cores.size();
+	T.meminfofd.assign(T.nodes.size(), -1);
+	T.numastatfd.assign(T.nodes.size(), -1);
+	T.loaded = true;
+	T.tp = std::chrono::steady_clock::time_point();
+      }
+
+      /** NUMA node of a CPU, -1 if unknown  */
+      int cpuNode(int cpu)
+      {
+	loadTopology();
+	return ( (cpu >= 0) && ((unsigned)cpu < TopologySummary.cpuNode.size()) )?TopologySummary.cpuNode[cpu]:-1;
+      }
+
+      /** Parses node meminfo lines: "Node 0 MemTotal:  5078776 kB" */
+      void parseNodeMeminfo(const char* data, Topology::NodeStats& st)
+      {
+	static const char* const keys[] = { "MemTotal", "MemFree", "MemUsed", "FilePages", "AnonPages", "Shmem", "Slab" };
+	uint64_t* const values[] = { &st.memTotal, &st.memFree, &st.memUsed, &st.filePages, &st.anonPages, &st.shmem, &st.slab };
+	while (*data)
+	  {
+	    const char* eol = strchr(data, '\n');
+	    const char* colon = strchr(data, ':');
+	    if (eol == NULL)
+	      eol = data+strlen(data);
+	    if ( (colon != NULL) && (colon < eol) )
+	      {
+		const char* key = colon;
+		while ( (key > data) && (key[-1] != ' ') )
+		  --key;
+		for (unsigned i=0; i<sizeof(keys)/sizeof(keys[0]); ++i)
+		  if ( (strncmp(key, keys[i], colon-key) == 0) && (keys[i][colon-key] == '\0') )
+		    {
+		      *values[i] = strtoull(colon+1, NULL, 10) * 1024;
+		      break;
+		    }
+	      }
+	    data = (*eol)?eol+1:eol;
+	  }
+      }
+    };
+
+  namespace Topology
+  {
+    /** Loads static topology again (e.g. after CPU hotplug)  */
+    static void reload()
+    {
+      loadTopology(true);
+    }
+
+    /** All logical CPUs  */
+    static std::vector<Cpu> cpus()
+    {
+      loadTopology();
+      return TopologySummary.cpus;
+    }
+
+    /** NUMA nodes. Just one if the system is not NUMA  */
+    static std::vector<Node> nodes()
+    {
+      loadTopology();
+      return TopologySummary.nodes;
+    }
+
+    static unsigned nodeCount()
+    {
+      loadTopology();
+      return TopologySummary.nodes.size();
+    }
+
+    /** Physical packages (sockets)  */
+    static unsigned packageCount()
+    {
+      loadTopology();
+      return TopologySummary.packages;
+    }
+
+    /** Physical cores (cpuCount() counts hyperthreads too)  */
+    static unsigned coreCount()
+    {
+      loadTopology();
+      return TopologySummary.cores;
+    }
+
+    /** NUMA node of a CPU, -1 if unknown  */
+    static int nodeOfCpu(unsigned cpu)
+    {
+      return cpuNode(cpu);
+    }
+
+    /** Memory and NUMA counters of all nodes. Node files are kept opened  */
+    static std::vector<NodeStats> nodeStats(bool reload=false)
+    {
+      loadTopology();
+      auto& T = TopologySummary;
+      if ( (!reload) && (T.tp+_valueDuration >= std::chrono::steady_clock::now()) )
+	return T.stats;
+
+      static const char* const numaKeys[] = { "numa_hit", "numa_miss", "numa_foreign", "interleave_hit", "local_node", "other_node" };
+      char buffer[4096];
+      T.stats.resize(T.nodes.size());
+      for (unsigned i=0; i<T.nodes.size(); ++i)
+	{
+	  NodeStats& st = T.stats[i];
+	  std::string dir = _sysRoot+"/devices/system/node/node"+std::to_string(T.nodes[i].id)+"/";
+	  st = NodeStats();
+	  st.node = T.nodes[i].id;
+	  /* Each one opened while it isn't: errno of meminfo if it can't be read */
+	  if (T.meminfofd[i] == -1)
+	    {
+	      T.meminfofd[i] = open((dir+"meminfo").c_str(), O_RDONLY | O_CLOEXEC);
+	      st.error = (T.meminfofd[i] == -1)?errno:0;
+	      ++_statsCounters.syscalls;
+	    }
+	  if (T.numastatfd[i] == -1)
+	    {
+	      T.numastatfd[i] = open((dir+"numastat").c_str(), O_RDONLY | O_CLOEXEC);
+	      ++_statsCounters.syscalls;
+	    }
+	  if (T.meminfofd[i] == -1)
+	    continue;
+	  errno = 0;
+	  if (readOpenedFile(T.meminfofd[i], buffer, sizeof(buffer)) <= 0)
+	    {
+	      st.error = (errno)?errno:ENODATA;
+	      continue;
+	    }
+	  parseNodeMeminfo(buffer, st);
+	  if ( (T.numastatfd[i] != -1) && (readOpenedFile(T.numastatfd[i], buffer, sizeof(buffer)) > 0) )
+	    {
+	      uint64_t* const numaValues[] = { &st.numaHit, &st.numaMiss, &st.numaForeign,
+					       &st.interleaveHit, &st.localNode, &st.otherNode };
+	      parseKeyValues(buffer, numaKeys, numaValues, 6);
+	    }
+	}
+      T.tp = std::chrono::steady_clock::now();
+      return T.stats;
+    }
+
+    /** Memory of a process in each NUMA node (bytes, index is node id), from
+	numa_maps. It walks all process mappings, so it's not cheap. */
+    static std::vector<uint64_t> processNodes(unsigned pid)
+    {
+      std::vector<uint64_t> result;
+      char filename[PATH_MAX];
+      snprintf(filename, PATH_MAX, "%s/%u/numa_maps", _procRoot.c_str(), pid);
+      std::string data = extractFile(filename, 65536);
+      const char* line = data.c_str();
+      while (*line)
+	{
+	  const char* eol = strchr(line, '\n');
+	  if (eol == NULL)
+	    eol = line+strlen(line);
+	  uint64_t pageSize = 4096;
+	  const char* kps = strstr(line, "kernelpagesize_kB=");
+	  if ( (kps != NULL) && (kps < eol) )
+	    pageSize = strtoull(kps+18, NULL, 10) * 1024;
+	  /* N<node>=<pages> */
+	  for (const char* n = strstr(line, " N"); (n != NULL) && (n < eol); n = strstr(n+2, " N"))
+	    {
+	      char* end;
+	      unsigned long node = strtoul(n+2, &end, 10);
+	      if ( (end == n+2) || (*end != '=') )
+		continue;
+	      if (node >= result.size())
+		result.resize(node+1, 0);
+	      result[node]+=strtoull(end+1, NULL, 10) * pageSize;
+	    }
+	  line = (*eol)?eol+1:eol;
+	}
+      return result;
+    }
+  };
+
+  /** Hardware sensors: hwmon temperatures, fans and power, and thermal zones  */
+  namespace Sensors
+  {
+    enum Type
+      {
+	TEMPERATURE,		/* Celsius */
+	FAN,			/* RPM */
+	POWER			/* Watts */
+      };
+
+    struct Sensor
+    {
+      std::string chip;		/* hwmon name (coretemp, nvme, ...) or thermal zone (thermal_zone0) */
+      std::string label;	/* its label, or type if there isn't */
+      std::string path;		/* file we read */
+      Type type;
+      double value;
+      int error;		/* errno if it can't be read */
+    };
+
+    /** Vector with sensors  */
+    typedef std::vector<Sensor> SensorList;
+  };
+
+  namespace Internal
+  {
+    /** Sensors (internal use). Discovered once, files kept opened */
+    struct SensorSummary_t
+    {
+      bool discovered;
+      std::string root;	/* sysRoot() when discovered */
+      Sensors::SensorList sensors;
+      std::vector<int> fds;
+      std::vector<double> scale;	/* value = file * scale */
+      std::map<std::string, unsigned> byLabel; /* label and chip/label */
+      std::chrono::steady_clock::time_point tp;
+    };
+  };
+
+  namespace
+    {
+      Internal::SensorSummary_t& SensorSummary = Internal::Shared<Internal::SensorSummary_t>::value;
+
+      void addSensor(std::string chip, std::string label, std::string path, Sensors::Type type, double scale)
+      {
+	auto& S = SensorSummary;
+	S.sensors.push_back(Sensors::Sensor({chip, label, path, type, NAN, 0}));
+	S.fds.push_back(-1);
+	S.scale.push_back(scale);
+	S.byLabel.insert(std::make_pair(label, S.sensors.size()-1)); /* first one wins */
+	S.byLabel[chip+"/"+label] = S.sensors.size()-1;
+      }
+
+      /** Finds sensors in hwmon and thermal classes (sysfs) */
+      void discoverSensors(bool rediscover=false)
+      {
+	auto& S = SensorSummary;
+	if ( (S.discovered) && (!rediscover) && (S.root == _sysRoot) )
+	  return;
+
+	for (auto fd : S.fds)
+	  if (fd != -1)
+	    close(fd);
+	S.sensors.clear();
+	S.fds.clear();
+	S.scale.clear();
+	S.byLabel.clear();
+	S.root = _sysRoot;
+	S.discovered = true;
+	S.tp = std::chrono::steady_clock::time_point();
+
+	/* hwmon: <type><n>_input, maybe with <type><n>_label */
+	std::string hwmonDir = _sysRoot+"/class/hwmon/";
+	std::vector<std::string> chips, inputs;
+	DIR* dir = opendir(hwmonDir.c_str());
+	_statsCounters.syscalls+=3;
+	if (dir != NULL)
+	  {
+	    direct *ent;
+	    while ((ent = readdir(dir)))
+	      if (strncmp(ent->d_name, "hwmon", 5) == 0)
+		chips.push_back(ent->d_name);
+	    closedir(dir);
+	  }
+	std::sort(chips.begin(), chips.end());
+	for (auto chip : chips)
+	  {
+	    std::string chipDir = hwmonDir+chip+"/";
+	    std::string name = extractFile((chipDir+"name").c_str(), 64);
+	    name = name.substr(0, name.find('\n'));
+	    if (name.empty())
+	      name = chip;
+	    inputs.clear();
+	    dir = opendir(chipDir.c_str());
+	    _statsCounters.syscalls+=3;
+	    if (dir == NULL)
+	      continue;
+	    direct *ent;
+	    while ((ent = readdir(dir)))
+	      {
+		const char* underscore = strchr(ent->d_name, '_');
+		if ( (underscore != NULL) && (strcmp(underscore, "_input") == 0) &&
+		     ( (strncmp(ent->d_name, "temp", 4) == 0) || (strncmp(ent->d_name, "fan", 3) == 0) ||
+		       (strncmp(ent->d_name, "power", 5) == 0) ) )
+		  inputs.push_back(std::string(ent->d_name, underscore-ent->d_name));
+	      }
+	    closedir(dir);
+	    std::sort(inputs.begin(), inputs.end());
+	    for (auto input : inputs)
+	      {
+		std::string label = extractFile((chipDir+input+"_label").c_str(), 64);
+		label = label.substr(0, label.find('\n'));
+		if (label.empty())
+		  label = input;
+		if (input[0] == 't')
+		  addSensor(name, label, chipDir+input+"_input", Sensors::TEMPERATURE, 0.001);
+		else if (input[0] == 'f')
+		  addSensor(name, label, chipDir+input+"_input", Sensors::FAN, 1);
+		else
+		  addSensor(name, label, chipDir+input+"_input", Sensors::POWER, 0.000001);
+	      }
+	  }
+
+	/* thermal zones: type and temp */
+	std::string thermalDir = _sysRoot+"/class/thermal/";
+	std::vector<std::string> zones;
+	dir = opendir(thermalDir.c_str());
+	_statsCounters.syscalls+=3;
+	if (dir != NULL)
+	  {
+	    direct *ent;
+	    while ((ent = readdir(dir)))
+	      if (strncmp(ent->d_name, "thermal_zone", 12) == 0)
+		zones.push_back(ent->d_name);
+	    closedir(dir);
+	  }
+	std::sort(zones.begin(), zones.end());
+	for (auto zone : zones)
+	  {
+	    std::string type = extractFile((thermalDir+zone+"/type").c_str(), 64);
+	    type = type.substr(0, type.find('\n'));
+	    addSensor(zone, (type.empty())?zone:type, thermalDir+zone+"/temp", Sensors::TEMPERATURE, 0.001);
+	  }
+      }
+
+      /** Reads all sensors again (pread on opened files) if values are old */
+      void refreshSensors(bool reload)
+      {
+	discoverSensors();
+	auto& S = SensorSummary;
+	if ( (!reload) && (S.tp+_valueDuration >= std::chrono::steady_clock::now()) )
+	  return;
+
+	uint64_t start = statsNow();
+	char buffer[64];
+	for (unsigned i=0; i<S.sensors.size(); ++i)
+	  {
+	    Sensors::Sensor& s = S.sensors[i];
+	    if (S.fds[i] == -1)
+	      {
+		S.fds[i] = open(s.path.c_str(), O_RDONLY | O_CLOEXEC);
+		++_statsCounters.syscalls;
+	      }
+	    /* Some sensors fail to read while the device sleeps (e.g. disks). We try again next time */
+	    if ( (S.fds[i] == -1) || (readOpenedFile(S.fds[i], buffer, sizeof(buffer)) <= 0) )
+	      {
+		s.error = errno;
+		s.value = NAN;
+	      }
+	    else
+	      {
+		s.error = 0;
+		s.value = strtod(buffer, NULL) * S.scale[i];
+	      }
+	  }
+	S.tp = std::chrono::steady_clock::now();
+	statsRecord(Stats::SENSORS, statsNow()-start);
+      }
+    };
+
+  namespace Sensors
+  {
+    /** All sensors. Values are cached for valueDuration()  */
+    static SensorList all(bool reload=false)
+    {
+      refreshSensors(reload);
+      return SensorSummary.sensors;
+    }
+
+    /** All sensors of a type  */
+    static SensorList byType(Type type, bool reload=false)
+    {
+      SensorList result;
+      refreshSensors(reload);
+      for (auto& s : SensorSummary.sensors)
+	if (s.type == type)
+	  result.push_back(s);
+      return result;
+    }
+
+    /** A sensor by its label ("Package id 0", "Core 1", "fan1"...) or chip/label
+	("coretemp/Core 1"). error is ENOENT if there isn't such sensor. */
+    static Sensor get(std::string label, bool reload=false)
+    {
+      refreshSensors(reload);
+      auto it = SensorSummary.byLabel.find(label);
+      if (it == SensorSummary.byLabel.end())
+	return Sensor({"", label, "", TEMPERATURE, NAN, ENOENT});
+      return SensorSummary.sensors[it->second];
+    }
+
+    /** Value of a sensor by label (NAN if it doesn't exist or can't be read) */
+    static double value(std::string label)
+    {
+      return get(label).value;
+    }
+
+    /** Highest temperature we have (NAN if none)  */
+    static double maxTemperature()
+    {
+      double result = NAN;
+      refreshSensors(false);
+      for (auto& s : SensorSummary.sensors)
+	if ( (s.type == TEMPERATURE) && (!std::isnan(s.value)) && ( (std::isnan(result)) || (s.value > result) ) )
+	  result = s.value;
+      return result;
+    }
+
+    /** Looks for sensors again (e.g. a module was loaded)  */
+    static void rediscover()
+    {
+      discoverSensors(true);
+    }
+  };
+
+  namespace Internal
+  {
+    /** Mount points information (internal use) */
+    struct MountSummary_t
+    {
+      Mounts::MountPoints points;
+      std::chrono::steady_clock::time_point tp; /* last mounts info fetched */
+    };
+
+    /** A statfs() made in its own thread. The thread shares it, so it can outlive
+	whoever started it (a hung network mount) without writing freed memory.
+	With UMON_NO_THREADS statfs() is just called (and it's done when started) */
+    struct StatfsJob
+    {
+#ifndef UMON_NO_THREADS
+      std::mutex mutex;
+      std::condition_variable cv;
+      pthread_t thread;
+#endif
+      bool done;
+      int err;
+      int notifyFd;		/* eventfd to write when done (-1 = none) */
+      struct statfs sfs;
+    };
+
+    /** Holds a StatfsJob while we look at it. Nothing to hold without threads */
+    struct StatfsLock
+    {
+#ifdef UMON_NO_THREADS
+      explicit StatfsLock(StatfsJob&)
+      {
+      }
+
+      void unlock()
+      {
+      }
+#else
+      explicit StatfsLock(StatfsJob& job): lock(job.mutex)
+      {
+      }
+
+      void unlock()
+      {
+	lock.unlock();
+      }
+
+      std::unique_lock<std::mutex> lock;
+#endif
+    };
+  };
+
+  namespace
+    {
+      using Internal::StatfsJob;
+      using Internal::StatfsLock;
+      Internal::MountSummary_t& MountSummary = Internal::Shared<Internal::MountSummary_t>::value;
+
+      /** Starts a statfs() thread  */
+      std::shared_ptr<StatfsJob> startStatfs(const std::string& path, int notifyFd)
+      {
+	std::shared_ptr<StatfsJob> job = std::make_shared<StatfsJob>();
+	job->done = false;
+	job->err = 0;
+	job->notifyFd = notifyFd;
+	memset(&job->sfs, 0, sizeof(job->sfs));
+
+#ifdef UMON_NO_THREADS
+	job->err = (statfs(path.c_str(), &job->sfs) < 0)?errno:0;
+	job->done = true;
+	++_statsCounters.allocations;
+	++_statsCounters.syscalls;
+	if (notifyFd != -1)
+	  {
+	    uint64_t one = 1;
+	    if (write(notifyFd, &one, sizeof(one)) > 0)
+	      ++_statsCounters.syscalls;
+	  }
+	return job;
+#else
+	std::thread sfsthread([job, path]() {
+	    /* A cancelled thread unwinds: it's done then too, so its mount point can be
+	       asked again (Async doesn't start another while one is still there) */
+	    struct Finished
+	    {
+	      StatfsJob& job;
+	      ~Finished()
+	      {
+		std::lock_guard<std::mutex> lock(job.mutex);
+		job.done = true;
+	      }
+	    } finished = { *job };
+	    struct statfs sfs;
+	    int err = (statfs(path.c_str(), &sfs) < 0)?errno:0;
+
+	    std::lock_guard<std::mutex> lock(job->mutex);
+	    job->sfs = sfs;
+	    job->err = err;
+	    job->done = true;
+	    job->cv.notify_all();
+	    if (job->notifyFd != -1)
+	      {
+		uint64_t one = 1;
+		if (write(job->notifyFd, &one, sizeof(one)) < 0)
+		  job->notifyFd = -1;
+	      }
+	  });
+	job->thread = sfsthread.native_handle();
+	sfsthread.detach();
+	_statsCounters.allocations+=3; /* job, path copy and thread */
+	++_statsCounters.syscalls;
+	return job;
+#endif
+      }
+
+      /** Copies statfs() results into a mount point (caller has the job lock)  */
+      void storeStatfs(Mounts::MountPoint& mp, const StatfsJob& job)
+      {
+	mp.blockSize = job.sfs.f_bsize;
+	mp.freeBlocks = job.sfs.f_bfree;
+	mp.freeBlocksUU = job.sfs.f_bavail;
+	mp.totalBlocks = job.sfs.f_blocks;
+	mp.maxNamelen = job.sfs.f_namelen;
+	mp.fileNodes = job.sfs.f_files;
+	mp.freeFileNodes = job.sfs.f_ffree;
+	mp.statfs_errno = job.err;
+      }
+
+      /** A mount point from a mtab entry, statfs() not made yet  */
+      Mounts::MountPoint mountPointEntry(const struct mntent* ent)
+      {
+	return Mounts::MountPoint({ent->mnt_fsname,
+	      ent->mnt_dir,
+	      ent->mnt_type,
+	      ent->mnt_opts,
+	      ent->mnt_freq,
+	      ent->mnt_passno,
+	      0,0,0,0,0,0,0,
+	      -1	/* Not ready yet */
+	      });
+      }
+    };
+
+  /** Mount point related stuff  */
+  namespace Mounts
+  {
+    /** Gets all mount points information  */
+    static MountPoints mountsInfo(bool reload=false)
+    {
+      MountPoints& res = MountSummary.points;
+      std::chrono::steady_clock::time_point& _mpinfo_tp = MountSummary.tp; /* last mounts info fetched */
+
+      if ( (!reload) && (_mpinfo_tp+_valueDuration >= std::chrono::steady_clock::now()) )
+	return res;
+
+      res.clear();
+
+      struct mntent *ent;
+      uint64_t start = statsNow(), mtabTime = 0, mtabStart = start;
+      FILE *fd = setmntent(_mtabFile.c_str(), "r");
+
+      ++_statsCounters.syscalls;
+      ++_statsCounters.refreshes;
       if (fd == NULL)
 	return res;
 
       while ( (ent = getmntent(fd)) != NULL)
 	{
+	  uint64_t statfsStart = statsNow();
+	  mtabTime+=statfsStart - mtabStart;
 	  /* c++11 futures can't be cancelled and this could cause memory corruption if
 	     statfs hangs. We must cancel it.*/
 	  /* c++11 threads also can't be cancelled. But as this lib is being used with
 	     POSIX threads, we can calcel them by hand. Quick and dirty, but it's the best
-	     we have. */
-	  /* Podemos hacer una función con esto */
-	  MountPoint *mp = new MountPoint({ent->mnt_fsname, 
-		ent->mnt_dir,
-		ent->mnt_type,
-		ent->mnt_opts,
-		ent->mnt_freq,
-		ent->mnt_passno,
-		0,0,0,0,0,0,0,
-		-1	/* Not ready yet */
-		});
-	  timed_mutex sfsmutex;
-	  std::mutex mpmutex;
-
-	  sfsmutex.lock();
-	  std::thread sfsthread([&]() {
-	      struct statfs sfs;
-	      errno=0;
-	      int err = statfs(mp->mountPoint.c_str(), &sfs);
-
-	      mpmutex.lock();
-	      mp->blockSize = sfs.f_bsize;
-	      mp->freeBlocks = sfs.f_bfree;
-	      mp->freeBlocksUU =sfs.f_bavail;
-	      mp->totalBlocks = sfs.f_blocks;
-	      mp->maxNamelen = sfs.f_namelen;
-	      mp->fileNodes = sfs.f_files;
-	      mp->freeFileNodes = sfs.f_ffree;
-	      mp->statfs_errno=(err<0)?errno:0;
-	      mpmutex.unlock();
-	      sfsmutex.unlock();
-	    });
-	  sfsthread.detach();
-
-	  if (!sfsmutex.try_lock_for(_mountWaiting))
+	     we have. The thread shares the job with us, so if it can't be cancelled it
+	     won't write anything freed. */
+	  MountPoint mp = mountPointEntry(ent);
+	  auto job = startStatfs(mp.mountPoint, -1);
+
+#ifdef UMON_NO_THREADS
+	  storeStatfs(mp, *job);	/* done when started */
+#else
+	  std::unique_lock<std::mutex> lock(job->mutex);
+	  if (!job->cv.wait_for(lock, _mountWaiting, [&job]() { return job->done; }))
 	    {
-	      pthread_cancel(sfsthread.native_handle());
+	      ++_statsCounters.timeouts;
+	      /* It can't finish while we have the lock, so the thread is still there */
+	      if (pthread_cancel(job->thread) == 0)
+		++_statsCounters.cancellations;
 	    }
 	  else
-	    sfsmutex.unlock();
+	    storeStatfs(mp, *job);
+	  lock.unlock();
+#endif
 
-	  mpmutex.lock();
-	  res.push_back(*mp);
-	  mpmutex.unlock();
+	  res.push_back(mp);
+	  mtabStart = statsNow();
+	  statsRecord(Stats::MOUNTS_STATFS, mtabStart - statfsStart);
 	}
 
       _mpinfo_tp = std::chrono::steady_clock::now();
 
       fclose(fd);
+      ++_statsCounters.syscalls;
+      mtabTime+=statsNow() - mtabStart;
+      statsRecord(Stats::MOUNTS_MTAB, mtabTime);
+      statsRecord(Stats::MOUNTS, statsNow()-start);
+      notifyRefresh(REFRESH_MOUNTS);
 
       return res;
     }
@@ -687,38 +2114,273 @@ namespace Umon
   /** Process related stuff  */
   namespace Proc
   {
-    /** Process user visible to the user */
-    struct SingleProc
+    /** Process states, as in the state field (proc(5)) */
+    enum State
+      {
+	STATE_RUNNING = 'R',
+	STATE_SLEEPING = 'S',
+	STATE_DISK_SLEEP = 'D',		/* uninterruptible */
+	STATE_ZOMBIE = 'Z',
+	STATE_STOPPED = 'T',
+	STATE_TRACING_STOP = 't',
+	STATE_DEAD = 'X',
+	STATE_IDLE = 'I',		/* idle kernel threads (4.14+) */
+	STATE_PARKED = 'P',		/* 3.9 - 3.13 */
+	STATE_WAKEKILL = 'K',		/* 2.6.33 - 3.13 */
+	STATE_WAKING = 'W'		/* 2.6.33 - 3.13 */
+      };
+
+    /** Secondary indexes of processes: pids by field value (see getByIndex()) */
+    enum Index
+      {
+	INDEX_STATE,
+	INDEX_UID,
+	INDEX_TTY,
+	INDEX_SESSION,
+	INDEX_PGRP,
+	INDEX_COUNT
+      };
+
+    /** Process events, queued while processes are read (see trackEvents()) */
+    enum EventType
+      {
+	EVENT_STARTED,
+	EVENT_EXITED,
+	EVENT_CHANGED
+      };
+
+    /** What changed in an EVENT_CHANGED event (bitmask) */
+    enum
+      {
+	CHANGED_PCPU = 1,
+	CHANGED_RSS = 2,
+	CHANGED_STATE = 4
+      };
+
+    /** A process event. Old values are the ones in the last event of
+	that process (or when it started), so small changes add up. */
+    struct Event
     {
-      std::string name;
-      char 
-      state;
-      int error,
-	pid,
-	ppid,
-	pgrp,
-	session,
-	tty;
-      double
-      pcpu,
-	totalpcpu;
-      unsigned long
-      flags,
-	vsize;
-      unsigned long long
-      start_time;
-      long
-      priority,
-	nice,
-	rss;
+      EventType type;
+      unsigned changes;		/* CHANGED_* */
+      int pid;
+      char name[32];
+      unsigned long long start_time;
+      char state,
+	oldState;
+      double pcpu,
+	oldPcpu;
+      long rss,			/* pages */
+	oldRss;
     };
 
-    /** Used when returning all processes with given name  */
-    struct MultiProc
+    /** Process metric columns (see columns() and query()) */
+    enum Column
+      {
+	COLUMN_PCPU,
+	COLUMN_TOTALPCPU,
+	COLUMN_VSIZE,
+	COLUMN_RSS,
+	COLUMN_STATE,
+	COLUMN_COUNT
+      };
+
+    /** Predicate comparisons */
+    enum Compare
+      {
+	CMP_LT,
+	CMP_LE,
+	CMP_GT,
+	CMP_GE,
+	CMP_EQ,
+	CMP_NE
+      };
+
+    /** Contiguous process metrics, one row per process (sorted by pid). Numeric
+	columns are doubles (integers are exact up to 2^53), so the same kernels
+	work for all of them. Valid until processes are read again. */
+    struct Columns
     {
-      std::string name;
-      double
-      pcpu,			/* Process instant cpu time */
+      size_t size;
+      const int* pid;
+      const double* pcpu;
+      const double* totalpcpu;
+      const double* vsize;	/* bytes */
+      const double* rss;	/* pages */
+      const char* state;
+    };
+
+    /** column cmp value. State values are characters (STATE_RUNNING...) */
+    struct Predicate
+    {
+      Column column;
+      Compare cmp;
+      double value;
+    };
+
+    /** Selection bitmap: bit i is row i of columns() */
+    struct Selection
+    {
+      std::vector<uint64_t> bits;
+      size_t rows;
+
+      bool test(size_t row) const
+      {
+	return (bits[row/64] >> (row%64)) & 1;
+      }
+
+      size_t count() const
+      {
+	size_t total = 0;
+	for (auto w : bits)
+	  total+=__builtin_popcountll(w);
+	return total;
+      }
+
+      /** Rows in both selections */
+      Selection& operator&=(const Selection& other)
+      {
+	for (size_t i=0; (i<bits.size()) && (i<other.bits.size()); ++i)
+	  bits[i]&=other.bits[i];
+	return *this;
+      }
+
+      /** Rows in any of them */
+      Selection& operator|=(const Selection& other)
+      {
+	for (size_t i=0; (i<bits.size()) && (i<other.bits.size()); ++i)
+	  bits[i]|=other.bits[i];
+	return *this;
+      }
+    };
+
+    /** Result of query(): number of rows matching all predicates, sums of some
+	columns over them and which rows they are */
+    struct QueryResult
+    {
+      size_t count;
+      double sum[COLUMN_COUNT];	/* just the columns asked for */
+      Selection selection;
+    };
+
+    /** Fields a Collector reads (bitmask, see Collector) */
+    enum Field
+      {
+	FIELD_NAME = 1<<0,
+	FIELD_STATE = 1<<1,
+	FIELD_PPID = 1<<2,
+	FIELD_PGRP = 1<<3,
+	FIELD_SESSION = 1<<4,
+	FIELD_TTY = 1<<5,
+	FIELD_TIMES = 1<<6,	/* utime, stime (ticks) */
+	FIELD_THREADS = 1<<7,
+	FIELD_START = 1<<8,	/* start_time (ticks after boot) */
+	FIELD_VSIZE = 1<<9,
+	FIELD_RSS = 1<<10,
+	FIELD_PROCESSOR = 1<<11,
+	FIELD_PCPU = 1<<12	/* %CPU since the previous scan */
+      };
+
+    /** Delay accounting totals in ns (see Taskstats)  */
+    struct Delays
+    {
+      unsigned long long
+      cpu,			/* waiting for a CPU */
+	blkio,			/* waiting for block I/O */
+	swapin,			/* waiting for pages to be swapped in */
+	reclaim;		/* in direct memory reclaim */
+
+      Delays& operator+=(const Delays& d)
+      {
+	cpu+=d.cpu;
+	blkio+=d.blkio;
+	swapin+=d.swapin;
+	reclaim+=d.reclaim;
+	return *this;
+      }
+    };
+
+    /** What processes are grouped by (see grouping())  */
+    enum Grouping
+      {
+	GROUP_NAME,		/* just by name (buildAdvancedSummary()): no groups kept */
+	GROUP_PIDNS,		/* PID namespace inode */
+	GROUP_CGROUP,		/* cgroup v2 path */
+	GROUP_CONTAINER		/* container id in the cgroup path ("" for the host) */
+      };
+
+    /** Processes in the same group, totals kept up to date while scanning  */
+    struct Group
+    {
+      std::string key;		/* namespace inode, cgroup path or container id */
+      unsigned
+      count;			/* processes */
+      double
+      pcpu,
+	totalpcpu,
+	pwait;			/* just with schedstat() */
+      unsigned long long
+      totalvsize;
+      long
+      totalrss;			/* pages */
+      std::set<unsigned> pids;
+    };
+
+    /** Process user visible to the user */
+    struct SingleProc
+    {
+      std::string name;
+      char 
+      state;
+      int error,
+	pid,
+	ppid,
+	pgrp,
+	session,
+	tty;
+      double
+      pcpu,
+	totalpcpu;
+      unsigned long
+      flags,
+	vsize;
+      unsigned long long
+      start_time;
+      long
+      priority,
+	nice,
+	rss;			/* pages */
+      unsigned long long
+      pss,			/* bytes, just with memoryDetails() (0 = not available) */
+	uss,			/* bytes, private memory */
+	swap;			/* bytes */
+      int
+      processor,		/* CPU it last ran on */
+	node,			/* NUMA node of that CPU (-1 = unknown) */
+	uid;			/* owner (-1 = unknown) */
+      double
+      pwait;			/* % of time waiting for a CPU (just with schedstat()) */
+      unsigned long long
+      runtime,			/* ns on CPU (just with schedstat()) */
+	waittime;		/* ns waiting for a CPU */
+      int
+      fds,			/* open files (-1 = not counted, see openFiles()) */
+	fdLimit;		/* RLIMIT_NOFILE soft limit (0 = unknown or unlimited) */
+      double
+      fdRate;			/* open files per second between the last two counts */
+      unsigned
+      fdGrowing;		/* counts in a row with more open files than the previous one */
+      Delays
+      delays,			/* totals (just with delays()) */
+	delaysDelta;		/* since the previous refresh */
+    };
+
+    /** Used when returning all processes with given name  */
+    struct MultiProc
+    {
+      std::string name;
+      double
+      pcpu,			/* Process instant cpu time */
 	totalpcpu;		/* Total cpu time from the beginning */
       unsigned long long
       totalvsize;
@@ -727,388 +2389,6106 @@ namespace Umon
       unsigned
       count;			/* Number of processes with this name */
       std::map <unsigned, SingleProc> processes; /* SingleProc with all processes */
+      unsigned long long
+      totalpss,			/* bytes, just with memoryDetails() */
+	totaluss,
+	totalswap;
+      double
+      pwait;			/* just with schedstat() */
+      Proc::Delays
+      totaldelays,		/* just with delays() */
+	totaldelaysDelta;
+    };
+  };
+
+  /** cgroup v2 (unified hierarchy) accounting  */
+  namespace Cgroup
+  {
+    /** What the kernel knows about a cgroup. Counters are totals since cgroup
+	creation, rates are calculated between the last two refreshes. */
+    struct CgroupStats
+    {
+      std::string path;		/* path relative to cgroupRoot(), e.g. /system.slice/nginx.service */
+      int error;		/* errno if the cgroup can't be read */
+      /* cpu.stat */
+      uint64_t
+      usageUsec,
+	userUsec,
+	systemUsec,
+	nrPeriods,
+	nrThrottled,
+	throttledUsec;
+      /* memory.current and memory.stat (bytes) */
+      uint64_t
+      memoryCurrent,
+	anon,
+	file,
+	kernelStack,
+	slab,
+	sock,
+	shmem,
+	pgfault,
+	pgmajfault;
+      /* io.stat (all devices) */
+      uint64_t
+      rbytes,
+	wbytes,
+	rios,
+	wios,
+	dbytes,
+	dios;
+      /* Rates */
+      double
+      pcpu,			/* %CPU since last refresh (100 = one core) */
+	readRate,		/* bytes/sec */
+	writeRate,		/* bytes/sec */
+	readIops,		/* read operations/sec */
+	writeIops;		/* write operations/sec */
+    };
+
+    /** cgroups by path */
+    typedef std::map<std::string, CgroupStats> Cgroups;
+  };
+
+  /** Internal types. Not in the anonymous namespace as they can be used as
+      members of public classes. */
+  namespace Internal
+  {
+    /** Used internally, lot of information about process.  */
+    struct proc_t 
+    {
+      char
+      state,
+	name[32];
+      unsigned char
+      updated,
+	newproc;			/* flag this process as updated */
+      int
+      error,			/* error reading anything */
+	pid,
+	ppid,
+	pgrp, 
+	session, 
+	tty,
+	tpgid,
+	nlwp,
+	processor,		/* last CPU (-1 = unknown) */
+	node,			/* NUMA node of nodeCpu-1 */
+	nodeCpu,		/* processor+1 node is cached for (0 = none) */
+	uid;			/* read when the process is new */
+      double
+      pcpu,
+	totalpcpu;
+
+      unsigned long
+      flags, 
+	min_flt, 
+	cmin_flt,
+	maj_flt, 
+	cmaj_flt,
+	vsize;
+
+      unsigned long long
+      utime,
+	stime,
+	cutime,
+	cstime,
+	start_time,
+	oldtime;
+
+      long
+      priority,
+	nice,
+	alarm,
+	rss;
+
+      unsigned long long
+      pss,			/* from smaps_rollup (bytes) */
+	uss,
+	swap;
+      long
+      memRss;			/* rss when smaps_rollup was read */
+      uint64_t
+      sampled;			/* when we read it (ns, steady clock) */
+      unsigned char
+      memSampled;		/* smaps_rollup was read at least once */
+      int
+      indexed[Proc::INDEX_COUNT];	/* values in ProcessIndex (Proc::Index) */
+      char
+      evState;			/* values in the last event of this process */
+      double
+      evPcpu;
+      long
+      evRss;
+      unsigned char
+      exited;			/* EVENT_EXITED was queued */
+      unsigned long long
+      runtime,			/* ns, from schedstat */
+	waittime,
+	oldRuntime,
+	oldWaittime;
+      double
+      pwait;
+      unsigned char
+      schedstat;		/* runtime and waittime were read */
+      int
+      fds,			/* entries in /proc/<pid>/fd */
+	fdLimit;		/* from /proc/<pid>/limits */
+      double
+      fdRate;
+      unsigned
+      fdGrowing;
+      uint64_t
+      fdSampled;		/* when fds were counted (0 = never) */
+      Proc::Delays
+      delays,			/* from taskstats */
+	delaysDelta;
+      unsigned char
+      delaysSampled;		/* delays were read */
+      unsigned
+      group;			/* in ProcessGroups (0 = none) */
+      unsigned char
+      grouped;			/* values are in group totals */
+    };
+
+    /** Process groups by key (internal use). Group 0 is not used */
+    struct ProcessGroups_t
+    {
+      std::vector<Proc::Group> groups;
+      std::unordered_map<std::string, unsigned> ids;
+      std::vector<unsigned> unused;	/* groups left empty, reused by new keys */
+    };
+
+    /** Queued process events (see Proc::takeEvents())  */
+    struct ProcessEvents_t
+    {
+      std::vector<Proc::Event> queue;
+    };
+
+    struct OpenFiles_t
+    {
+      std::function<bool(const Proc::SingleProc&)> filter; /* Proc::openFilesFilter() */
+    };
+
+    /** Generic netlink socket to ask for taskstats (internal use)  */
+    struct Taskstats_t
+    {
+      /** Requests sent at once: replies must fit in the socket receive buffer */
+      enum { BATCH = 64 };
+
+      bool opened;
+      int fd;
+      uint16_t family;		/* TASKSTATS family id */
+      uint32_t seq;
+      std::function<bool(const Proc::SingleProc&)> filter; /* Proc::delaysFilter() */
+      char buffers[BATCH][1024];	/* replies of a batch */
+    };
+
+    /** stat file fields a Collector needs, by their number in proc(5) (pid is 1) */
+    struct StatFields
+    {
+      const char* name;
+      size_t nameLen;
+      char state;
+      long long v[40];
+    };
+
+    /** Record parts: the fields of a Field flag, the last stat field they need
+	and how they're loaded */
+    struct PartName
+    {
+      enum { FIELD = Proc::FIELD_NAME, LAST = 2 };
+      char name[32];
+      void load(const StatFields& f)
+      {
+	size_t len = std::min(f.nameLen, sizeof(name)-1);
+	memcpy(name, f.name, len);
+	name[len] = '\0';
+      }
+    };
+
+    struct PartState
+    {
+      enum { FIELD = Proc::FIELD_STATE, LAST = 3 };
+      char state;
+      void load(const StatFields& f) { state = f.state; }
+    };
+
+    struct PartPpid
+    {
+      enum { FIELD = Proc::FIELD_PPID, LAST = 4 };
+      int ppid;
+      void load(const StatFields& f) { ppid = f.v[4]; }
+    };
+
+    struct PartPgrp
+    {
+      enum { FIELD = Proc::FIELD_PGRP, LAST = 5 };
+      int pgrp;
+      void load(const StatFields& f) { pgrp = f.v[5]; }
+    };
+
+    struct PartSession
+    {
+      enum { FIELD = Proc::FIELD_SESSION, LAST = 6 };
+      int session;
+      void load(const StatFields& f) { session = f.v[6]; }
+    };
+
+    struct PartTty
+    {
+      enum { FIELD = Proc::FIELD_TTY, LAST = 7 };
+      int tty;
+      void load(const StatFields& f) { tty = f.v[7]; }
+    };
+
+    struct PartTimes
+    {
+      enum { FIELD = Proc::FIELD_TIMES, LAST = 15 };
+      unsigned long long utime, stime;
+      void load(const StatFields& f) { utime = f.v[14]; stime = f.v[15]; }
+    };
+
+    struct PartThreads
+    {
+      enum { FIELD = Proc::FIELD_THREADS, LAST = 20 };
+      int nlwp;
+      void load(const StatFields& f) { nlwp = f.v[20]; }
+    };
+
+    struct PartStart
+    {
+      enum { FIELD = Proc::FIELD_START, LAST = 22 };
+      unsigned long long start_time;
+      void load(const StatFields& f) { start_time = f.v[22]; }
+    };
+
+    struct PartVsize
+    {
+      enum { FIELD = Proc::FIELD_VSIZE, LAST = 23 };
+      unsigned long vsize;
+      void load(const StatFields& f) { vsize = f.v[23]; }
+    };
+
+    struct PartRss
+    {
+      enum { FIELD = Proc::FIELD_RSS, LAST = 24 };
+      long rss;
+      void load(const StatFields& f) { rss = f.v[24]; }
+    };
+
+    struct PartProcessor
+    {
+      enum { FIELD = Proc::FIELD_PROCESSOR, LAST = 39 };
+      int processor;
+      void load(const StatFields& f) { processor = f.v[39]; }
+    };
+
+    /** ticks and started are there to calculate pcpu in the next scan */
+    struct PartPcpu
+    {
+      enum { FIELD = Proc::FIELD_PCPU, LAST = 22 };
+      double pcpu;
+      unsigned long long ticks, started;
+      void load(const StatFields& f) { pcpu = 0; ticks = f.v[14] + f.v[15]; started = f.v[22]; }
+    };
+
+    /** A part we don't want: no members (empty base), nothing to load */
+    template <bool Present, typename Part>
+    struct RecordPart
+    {
+      void load(const StatFields&) {}
+    };
+
+    template <typename Part>
+    struct RecordPart<true, Part> : Part
+    {
+    };
+
+    constexpr unsigned maxField(unsigned a)
+    {
+      return a;
+    }
+
+    template <typename... T>
+    constexpr unsigned maxField(unsigned a, unsigned b, T... rest)
+    {
+      return maxField((a>b)?a:b, rest...);
+    }
+
+    /** A record with the parts in Fields, so its size is just what they need */
+    template <unsigned Fields, typename... Parts>
+    struct RecordOf : RecordPart<(Fields & Parts::FIELD) != 0, Parts>...
+    {
+      enum { LAST = maxField(1, ((Fields & Parts::FIELD)?(unsigned)Parts::LAST:1u)...) };
+      int pid;
+
+      void load(const StatFields& f)
+      {
+	pid = f.v[1];
+	int expand[] = { 0, (RecordPart<(Fields & Parts::FIELD) != 0, Parts>::load(f), 0)... };
+	(void)expand;
+      }
     };
   };
 
+  namespace Proc
+  {
+    /** What a Collector<Fields> gives for each process: pid and the members of
+	the fields asked for (name, state, ppid, pgrp, session, tty, utime and stime,
+	nlwp, start_time, vsize, rss, processor, pcpu) */
+    template <unsigned Fields>
+    using Record = Internal::RecordOf<Fields, Internal::PartName, Internal::PartState,
+				      Internal::PartPpid, Internal::PartPgrp, Internal::PartSession,
+				      Internal::PartTty, Internal::PartTimes, Internal::PartThreads,
+				      Internal::PartStart, Internal::PartVsize, Internal::PartRss,
+				      Internal::PartProcessor, Internal::PartPcpu>;
+  };
+
   /** Private processes stuff  */
   namespace
     {
-      /** Used internally, lot of information about process.  */
-      struct proc_t 
-      {
-	char
-	state,
-	  name[32];
-	unsigned char
- 	updated,
-	  newproc;			/* flag this process as updated */
-	int
-	error,			/* error reading anything */
-	  pid,
-	  ppid,
-	  pgrp, 
-	  session, 
-	  tty,
-	  tpgid,
-	  nlwp;
-	double
-	pcpu,
-	  totalpcpu;
-
-	unsigned long
-	flags, 
-	  min_flt, 
-	  cmin_flt,
-	  maj_flt, 
-	  cmaj_flt,
-	  vsize;
-
-	unsigned long long
-	utime,
-	  stime,
-	  cutime,
-	  cstime,
-	  start_time,
-	  oldtime;
-
-	long
-	priority,
-	  nice,
-	  alarm,
-	  rss;
-      };
+      using Internal::proc_t;
 
-      /** Processes information struct (internal use)  */
-      struct
+      /** Process information visible to the user  */
+      Proc::SingleProc singleProc(const proc_t* _p)
       {
-	std::chrono::steady_clock::duration generationTime;
+	return Proc::SingleProc({_p->name, _p->state, _p->error, _p->pid,
+	      _p->ppid, _p->pgrp,      _p->session, _p->tty,
+	      _p->pcpu, _p->totalpcpu, _p->flags,   _p->vsize,
+	      _p->start_time, _p->priority, _p->nice, _p->rss,
+	      _p->pss, _p->uss, _p->swap, _p->processor, _p->node, _p->uid,
+	      _p->pwait, _p->runtime, _p->waittime,
+	      (_p->fdSampled)?_p->fds:-1, _p->fdLimit, _p->fdRate, _p->fdGrowing,
+	      _p->delays, _p->delaysDelta});
+      }
 
-	std::map<std::string, Proc::MultiProc> advanced;
-	std::map<unsigned, proc_t*> processes;
-      } ProcessSummary;
+    };
 
-      /** Fill in process struct with useful information. Even calculate %CPU from 
-       last call it there have been enough time between calls. */
-      bool createProcessSummary(char *procId, double timeFromLast, unsigned char update)
+  namespace Internal
+  {
+    /** Processes information struct (internal use)  */
+    struct ProcessSummary_t
+    {
+      std::chrono::steady_clock::duration generationTime;
+
+      std::chrono::steady_clock::time_point lastBuild; /* last summary built */
+
+      std::map<std::string, Proc::MultiProc> advanced;
+      std::chrono::steady_clock::time_point lastAdvanced; /* last advanced summary built */
+      std::map<unsigned, proc_t*> processes;
+    };
+  };
+
+  namespace
+    {
+      Internal::ProcessSummary_t& ProcessSummary = Internal::Shared<Internal::ProcessSummary_t>::value;
+
+    };
+
+  namespace Internal
+  {
+    /** Secondary indexes of ProcessSummary.processes (Proc::Index). They change just
+	when a process is new, finishes or changes that field, so queries are O(result) */
+    struct ProcessIndex_t
+    {
+      std::map<int, std::set<unsigned>> byValue[Proc::INDEX_COUNT]; /* value -> pids, for each index */
+    };
+  };
+
+  namespace
+    {
+      auto& ProcessIndex = Internal::Shared<Internal::ProcessIndex_t>::value.byValue;
+
+      /** Values of a process for each index  */
+      void indexValues(const proc_t* P, int values[Proc::INDEX_COUNT])
       {
-	char filename[32];
-	snprintf(filename, 32, "/proc/%s/stat", procId);
-	std::string proc = extractFile(filename);
-	unsigned num;
-	short namelen;
-	char* tmp = (char*)proc.c_str();
-	unsigned long long procuptime, total_time;
-	proc_t* P=ProcessSummary.processes[atoi(procId)];
-	if (P == NULL)
+	values[Proc::INDEX_STATE] = P->state;
+	values[Proc::INDEX_UID] = P->uid;
+	values[Proc::INDEX_TTY] = P->tty;
+	values[Proc::INDEX_SESSION] = P->session;
+	values[Proc::INDEX_PGRP] = P->pgrp;
+      }
+
+      /** Updates indexes for a process read just now  */
+      void indexProcess(proc_t* P, bool isNew)
+      {
+	int values[Proc::INDEX_COUNT];
+	indexValues(P, values);
+	for (unsigned i=0; i<Proc::INDEX_COUNT; ++i)
 	  {
-	    P = (proc_t*)malloc(sizeof(proc_t));
-	    P->newproc = 1;
-	    P-> oldtime = 0;
+	    if ( (!isNew) && (P->indexed[i] == values[i]) )
+	      continue;
+	    if (!isNew)
+	      {
+		auto old = ProcessIndex[i].find(P->indexed[i]);
+		if (old != ProcessIndex[i].end())
+		  {
+		    old->second.erase(P->pid);
+		    if (old->second.empty())
+		      ProcessIndex[i].erase(old);
+		  }
+	      }
+	    ProcessIndex[i][values[i]].insert(P->pid);
+	    ++_statsCounters.allocations;
+	    P->indexed[i] = values[i];
 	  }
-	else
-	  P->newproc = 0;
+      }
 
-	sscanf(tmp, "%d", &P->pid);
-	char *pstart=strchr(tmp, '('), *pend=strchr(tmp,')');
-	if ( (pstart==NULL) || (pend ==NULL) )
+      /** Removes a finished process from indexes  */
+      void unindexProcess(const proc_t* P)
+      {
+	for (unsigned i=0; i<Proc::INDEX_COUNT; ++i)
 	  {
-	    P->error=1;		/* we shouldn't see this here. It could be a kernel error */
+	    auto it = ProcessIndex[i].find(P->indexed[i]);
+	    if (it == ProcessIndex[i].end())
+	      continue;
+	    it->second.erase(P->pid);
+	    if (it->second.empty())
+	      ProcessIndex[i].erase(it);
 	  }
-	else
+      }
+
+      Internal::ProcessGroups_t& ProcessGroups = Internal::Shared<Internal::ProcessGroups_t>::value;
+
+      /** cgroup v2 path of a process from /proc/<pid>/cgroup ("0::/path" line) */
+      std::string readProcessCgroup(unsigned pid)
+      {
+	char filename[PATH_MAX];
+	snprintf(filename, PATH_MAX, "%s/%u/cgroup", _procRoot.c_str(), pid);
+	std::string data = extractFile(filename);
+	std::string path;
+	size_t pos = (data.compare(0, 3, "0::")==0)?0:data.find("\n0::");
+	if (pos != std::string::npos)
 	  {
-	    size_t namesize = (pend-pstart<33)?pend-pstart-1:32;
-	    strncpy(P->name, pstart+1, namesize);
-	    P->name[namesize] = '\0';
-	    /* Borrowed from readproc from procps */
-	    num = sscanf(pend+2,
-			 "%c "
-			 "%d %d %d %d %d "
-			 "%lu %lu %lu %lu %lu "
-			 "%Lu %Lu %Lu %Lu "  /* utime stime cutime cstime */
-			 "%ld %ld "
-			 "%d "
-			 "%ld "
-			 "%Lu "  /* start_time */
-			 "%lu "  /* Vsize */
-			 "%ld ", /* Resident size */
-			 &P->state,
-			 &P->ppid, &P->pgrp, &P->session, &P->tty, &P->tpgid,
-			 &P->flags, &P->min_flt, &P->cmin_flt, &P->maj_flt, &P->cmaj_flt,
+	    pos = data.find("::", pos)+2;
+	    path = data.substr(pos, data.find('\n', pos)-pos);
+	  }
+	return path;
+      }
+
+      /** Container id in a cgroup path: the last run of 64 hex digits (docker-<id>.scope,
+	  /docker/<id>, cri-containerd-<id>.scope, libpod-<id>.scope...). Empty if none */
+      std::string containerId(const std::string& path)
+      {
+	std::string id;
+	size_t run = 0;
+	for (size_t i=0; i<=path.size(); ++i)
+	  {
+	    if ( (i<path.size()) && (isxdigit(path[i])) )
+	      {
+		++run;
+		continue;
+	      }
+	    if (run == 64)
+	      id = path.substr(i-64, 64);
+	    run = 0;
+	  }
+	return id;
+      }
+
+      /** Group key of a process for the current grouping. Empty if we can't know it */
+      std::string groupKey(const proc_t* P)
+      {
+	if (_grouping == Proc::GROUP_PIDNS)
+	  {
+	    /* "pid:[4026531836]": the inode identifies the namespace */
+	    char filename[PATH_MAX];
+	    char link[64];
+	    snprintf(filename, PATH_MAX, "%s/%d/ns/pid", _procRoot.c_str(), P->pid);
+	    ssize_t len = readlink(filename, link, sizeof(link)-1);
+	    ++_statsCounters.syscalls;
+	    if (len <= 0)
+	      return std::string();
+	    link[len] = '\0';
+	    const char* ino = strchr(link, '[');
+	    return (ino)?std::string(ino+1, strcspn(ino+1, "]")):std::string(link);
+	  }
+	std::string path = readProcessCgroup(P->pid);
+	return (_grouping == Proc::GROUP_CGROUP)?path:containerId(path);
+      }
+
+      /** Takes a process out of a group. A group left empty is forgotten (short
+	  lived containers would add keys forever) */
+      void leaveGroup(proc_t* P)
+      {
+	auto& G = ProcessGroups;
+	Proc::Group& g = G.groups[P->group];
+	g.pids.erase(P->pid);
+	if (g.pids.empty())
+	  {
+	    G.ids.erase(g.key);
+	    g = Proc::Group();
+	    G.unused.push_back(P->group);
+	  }
+	P->group = 0;
+      }
+
+      /** Takes a process out of its group totals (before its values change). A
+	  finished process leaves the group. */
+      void ungroupProcess(proc_t* P, bool finished)
+      {
+	if (!P->group)
+	  return;
+	Proc::Group& g = ProcessGroups.groups[P->group];
+	if (P->grouped)
+	  {
+	    g.pcpu-=P->pcpu;
+	    g.totalpcpu-=P->totalpcpu;
+	    g.pwait-=P->pwait;
+	    g.totalvsize-=P->vsize;
+	    g.totalrss-=P->rss;
+	    if (--g.count == 0)	/* no rounding errors left behind */
+	      g.pcpu = g.totalpcpu = g.pwait = 0;
+	    P->grouped = 0;
+	  }
+	if (finished)
+	  leaveGroup(P);
+      }
+
+      /** Adds a process to its group totals. Its key is found again just if resolve
+	  is set (it's new, the pid was reused or it called exec()) */
+      void groupProcess(proc_t* P, bool resolve)
+      {
+	auto& G = ProcessGroups;
+	if (G.groups.empty())
+	  G.groups.resize(1);
+	if ( (resolve) || (!P->group) )
+	  {
+	    std::string key = groupKey(P);
+	    auto id = G.ids.find(key);
+	    unsigned group;
+	    if (id != G.ids.end())
+	      group = id->second;
+	    else if (!G.unused.empty())
+	      {
+		group = G.unused.back();
+		G.unused.pop_back();
+		G.groups[group].key = key;
+		G.ids[key] = group;
+		++_statsCounters.allocations;
+	      }
+	    else
+	      {
+		group = G.groups.size();
+		G.groups.push_back(Proc::Group());
+		G.groups.back().key = key;
+		G.ids[key] = group;
+		_statsCounters.allocations+=2;
+	      }
+	    if (group != P->group)
+	      {
+		if (P->group)
+		  leaveGroup(P);
+		G.groups[group].pids.insert(P->pid);
+		++_statsCounters.allocations;
+		P->group = group;
+	      }
+	  }
+	Proc::Group& g = G.groups[P->group];
+	g.pcpu+=P->pcpu;
+	g.totalpcpu+=P->totalpcpu;
+	g.pwait+=P->pwait;
+	g.totalvsize+=P->vsize;
+	g.totalrss+=P->rss;
+	++g.count;
+	P->grouped = 1;
+      }
+    };
+
+  namespace Internal
+  {
+    /** ProcessSummary.processes in columns (see Proc::columns()). Built when
+	they are needed and processes were read after the last build  */
+    struct ProcessColumns_t
+    {
+      bool valid;
+      std::vector<proc_t*> rows;
+      std::vector<int> pid;
+      std::vector<double> pcpu, totalpcpu, vsize, rss;
+      std::vector<char> state;
+    };
+  };
+
+  namespace
+    {
+      Internal::ProcessColumns_t& ProcessColumns = Internal::Shared<Internal::ProcessColumns_t>::value;
+
+      /** Rows evaluated at a time: masks stay in L1 while all predicates and sums run */
+      enum { COLUMN_BLOCK = 1024 };
+
+      void buildColumns()
+      {
+	auto& c = ProcessColumns;
+	if (c.valid)
+	  return;
+
+	size_t n = ProcessSummary.processes.size();
+	if (n > c.rows.capacity())
+	  _statsCounters.allocations+=7;
+	c.rows.resize(n);
+	c.pid.resize(n);
+	c.pcpu.resize(n);
+	c.totalpcpu.resize(n);
+	c.vsize.resize(n);
+	c.rss.resize(n);
+	c.state.resize(n);
+	size_t row = 0;
+	for (auto& p : ProcessSummary.processes)
+	  {
+	    proc_t* P = p.second;
+	    c.rows[row] = P;
+	    c.pid[row] = P->pid;
+	    c.pcpu[row] = P->pcpu;
+	    c.totalpcpu[row] = P->totalpcpu;
+	    c.vsize[row] = P->vsize;
+	    c.rss[row] = P->rss;
+	    c.state[row] = P->state;
+	    ++row;
+	  }
+	c.valid = true;
+      }
+
+      const double* numericColumn(Proc::Column column)
+      {
+	switch (column)
+	  {
+	  case Proc::COLUMN_PCPU: return ProcessColumns.pcpu.data();
+	  case Proc::COLUMN_TOTALPCPU: return ProcessColumns.totalpcpu.data();
+	  case Proc::COLUMN_VSIZE: return ProcessColumns.vsize.data();
+	  case Proc::COLUMN_RSS: return ProcessColumns.rss.data();
+	  default: return NULL;
+	  }
+      }
+
+      /** Rows per inner loop. A constant trip count lets gcc vectorize them even
+	  at -O2 (the very cheap cost model won't vectorize loops of unknown length). */
+      enum { COLUMN_LANES = 16 };
+
+      /** mask[i] &= cmp(col[i], value) */
+      template <typename T, typename C>
+      void columnFilter(const T* __restrict__ col, size_t n, T value, unsigned char* __restrict__ mask, C cmp)
+      {
+	size_t i = 0;
+	for (; i+COLUMN_LANES<=n; i+=COLUMN_LANES)
+	  for (unsigned k=0; k<COLUMN_LANES; ++k)
+	    mask[i+k] &= cmp(col[i+k], value);
+	for (; i<n; ++i)
+	  mask[i] &= cmp(col[i], value);
+      }
+
+      /** The switch is out of the loop, so each loop is a plain compare */
+      template <typename T>
+      void columnFilter(const T* col, size_t n, Proc::Compare cmp, T value, unsigned char* mask)
+      {
+	switch (cmp)
+	  {
+	  case Proc::CMP_LT: columnFilter(col, n, value, mask, std::less<T>()); break;
+	  case Proc::CMP_LE: columnFilter(col, n, value, mask, std::less_equal<T>()); break;
+	  case Proc::CMP_GT: columnFilter(col, n, value, mask, std::greater<T>()); break;
+	  case Proc::CMP_GE: columnFilter(col, n, value, mask, std::greater_equal<T>()); break;
+	  case Proc::CMP_EQ: columnFilter(col, n, value, mask, std::equal_to<T>()); break;
+	  case Proc::CMP_NE: columnFilter(col, n, value, mask, std::not_equal_to<T>()); break;
+	  }
+      }
+
+      /** Sum of col[i] where mask[i] (masks are 0 or 1). One accumulator per lane:
+	  additions are not reordered (no -ffast-math needed) and don't wait for each other. */
+      double columnSum(const double* __restrict__ col, size_t n, const unsigned char* __restrict__ mask)
+      {
+	double acc[COLUMN_LANES] = { 0 };
+	size_t i = 0;
+	for (; i+COLUMN_LANES<=n; i+=COLUMN_LANES)
+	  for (unsigned k=0; k<COLUMN_LANES; ++k)
+	    acc[k] += col[i+k] * mask[i+k];
+	for (; i<n; ++i)
+	  acc[0] += col[i] * mask[i];
+
+	double total = 0;
+	for (unsigned k=0; k<COLUMN_LANES; ++k)
+	  total+=acc[k];
+	return total;
+      }
+
+      /** Packs a mask of n rows into bits. Returns how many are set  */
+      size_t packMask(const unsigned char* mask, size_t n, uint64_t* bits)
+      {
+	size_t count = 0, w = 0;
+	for (; (w+1)*64<=n; ++w)
+	  {
+	    /* 8 mask bytes (0 or 1) at a time: the multiplication moves byte k
+	       to bit 56+k, so the top byte has them all */
+	    uint64_t word = 0;
+	    for (unsigned k=0; k<8; ++k)
+	      {
+		uint64_t bytes;
+		memcpy(&bytes, mask+w*64+k*8, 8);
+		word |= ((bytes * 0x0102040810204080ULL) >> 56) << (k*8);
+	      }
+	    bits[w] = word;
+	    count+=__builtin_popcountll(word);
+	  }
+	if (w*64 < n)
+	  {
+	    uint64_t word = 0;
+	    for (size_t k=0; w*64+k<n; ++k)
+	      word |= (uint64_t)mask[w*64+k] << k;
+	    bits[w] = word;
+	    count+=__builtin_popcountll(word);
+	  }
+	return count;
+      }
+
+      /** Evaluates all predicates and sums (sums is a bitmask of 1<<Column) in
+	  one pass over the columns, COLUMN_BLOCK rows at a time */
+      void columnQuery(const Proc::Predicate* where, size_t npred, unsigned sums, Proc::QueryResult& result)
+      {
+	auto& c = ProcessColumns;
+	size_t n = c.rows.size();
+	unsigned char mask[COLUMN_BLOCK];
+
+	result.count = 0;
+	memset(result.sum, 0, sizeof(result.sum));
+	result.selection.rows = n;
+	result.selection.bits.resize((n+63)/64);
+	for (size_t start=0; start<n; start+=COLUMN_BLOCK)
+	  {
+	    size_t len = std::min((size_t)COLUMN_BLOCK, n-start);
+	    memset(mask, 1, len);
+	    for (size_t p=0; p<npred; ++p)
+	      {
+		if (where[p].column == Proc::COLUMN_STATE)
+		  columnFilter(c.state.data()+start, len, where[p].cmp, (char)where[p].value, mask);
+		else if (where[p].column < Proc::COLUMN_STATE)
+		  columnFilter(numericColumn(where[p].column)+start, len, where[p].cmp, where[p].value, mask);
+	      }
+	    for (int col=0; col<Proc::COLUMN_STATE; ++col)
+	      {
+		if (sums & (1<<col))
+		  result.sum[col] += columnSum(numericColumn((Proc::Column)col)+start, len, mask);
+	      }
+	    result.count += packMask(mask, len, result.selection.bits.data()+start/64);
+	  }
+      }
+
+      /** Queued process events (see Proc::takeEvents())  */
+      std::vector<Proc::Event>& ProcessEvents = Internal::Shared<Internal::ProcessEvents_t>::value.queue;
+
+      /** Queues an event with current values of a process. NULL if the queue is full  */
+      Proc::Event* queueEvent(Proc::EventType type, const proc_t* P)
+      {
+	if (ProcessEvents.size() >= _eventQueueLimit)
+	  {
+	    ++_eventsDropped;
+	    return NULL;
+	  }
+	if (ProcessEvents.size() == ProcessEvents.capacity())
+	  ++_statsCounters.allocations;
+	ProcessEvents.push_back(Proc::Event());
+	Proc::Event* e = &ProcessEvents.back();
+	e->type = type;
+	e->changes = 0;
+	e->pid = P->pid;
+	memcpy(e->name, P->name, sizeof(e->name));
+	e->start_time = P->start_time;
+	e->state = e->oldState = P->state;
+	e->pcpu = e->oldPcpu = P->pcpu;
+	e->rss = e->oldRss = P->rss;
+	return e;
+      }
+
+      /** Values next changes will be compared to  */
+      void eventBaseline(proc_t* P)
+      {
+	P->evState = P->state;
+	P->evPcpu = P->pcpu;
+	P->evRss = P->rss;
+	P->exited = 0;
+      }
+
+      /** Queues events for a process read just now. oldStart and oldName are the
+	  values it had before: if start_time changed, the pid was reused. */
+      void processEvents(proc_t* P, unsigned long long oldStart, const char* oldName)
+      {
+	if ( (!P->newproc) && (P->start_time == oldStart) && (!P->exited) )
+	  {
+	    unsigned changes = 0;
+	    if ( (_eventPcpuThreshold>0) && (fabs(P->pcpu - P->evPcpu) >= _eventPcpuThreshold) )
+	      changes|=Proc::CHANGED_PCPU;
+	    if ( (_eventRssThreshold>0) && (labs(P->rss - P->evRss) >= _eventRssThreshold) )
+	      changes|=Proc::CHANGED_RSS;
+	    if (P->state != P->evState)
+	      changes|=Proc::CHANGED_STATE;
+	    if (!changes)
+	      return;
+
+	    Proc::Event* e = queueEvent(Proc::EVENT_CHANGED, P);
+	    if (!e)
+	      return;
+	    e->changes = changes;
+	    e->oldState = P->evState;
+	    e->oldPcpu = P->evPcpu;
+	    e->oldRss = P->evRss;
+	    /* Unchanged values keep accumulating */
+	    if (changes & Proc::CHANGED_PCPU)
+	      P->evPcpu = P->pcpu;
+	    if (changes & Proc::CHANGED_RSS)
+	      P->evRss = P->rss;
+	    P->evState = P->state;
+	    return;
+	  }
+
+	/* Pid reused before we could see the old process finish */
+	if ( (!P->newproc) && (!P->exited) )
+	  {
+	    Proc::Event* e = queueEvent(Proc::EVENT_EXITED, P);
+	    if (e)
+	      {
+		memcpy(e->name, oldName, sizeof(e->name));
+		e->start_time = oldStart;
+		e->state = e->oldState = P->evState;
+		e->pcpu = e->oldPcpu = P->evPcpu;
+		e->rss = e->oldRss = P->evRss;
+	      }
+	  }
+	queueEvent(Proc::EVENT_STARTED, P);
+	eventBaseline(P);
+      }
+
+      /* directory entries as getdents64 gives them */
+      struct linux_dirent64
+      {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+      };
+
+    };
+
+  namespace Internal
+  {
+    /** Incremental scan state, to resume where we stopped (see Proc::scanStep()) */
+    struct IncrementalScan_t
+    {
+      int fd = -1;			/* procRoot() directory */
+      std::string root;		/* procRoot() when fd was opened */
+      char buffer[32768];		/* getdents64 buffer */
+      long nread, pos;
+      bool passStarted;
+      std::chrono::steady_clock::time_point passStart;
+    };
+  };
+
+  namespace
+    {
+      Internal::IncrementalScan_t& IncrementalScan = Internal::Shared<Internal::IncrementalScan_t>::value;
+
+      /** Fill in process struct with useful information. Even calculate %CPU from 
+       last call it there have been enough time between calls. */
+      /** Parses /proc/<pid>/stat contents into a process struct. Returns false
+	  if it can't be parsed. */
+      bool parseProcStat(const char* tmp, proc_t* P)
+      {
+	sscanf(tmp, "%d", &P->pid);
+	/* Process name can have parenthesis too, so we look for the last one */
+	const char *pstart=strchr(tmp, '('), *pend=strrchr(tmp,')');
+	if ( (pstart==NULL) || (pend ==NULL) )
+	  {
+	    P->error=1;		/* we shouldn't see this here. It could be a kernel error */
+	    return false;
+	  }
+
+	size_t namesize = (pend-pstart<33)?pend-pstart-1:32;
+	strncpy(P->name, pstart+1, namesize);
+	P->name[namesize] = '\0';
+	/* Borrowed from readproc from procps */
+	int num = sscanf(pend+2,
+			 "%c "
+			 "%d %d %d %d %d "
+			 "%lu %lu %lu %lu %lu "
+			 "%Lu %Lu %Lu %Lu "  /* utime stime cutime cstime */
+			 "%ld %ld "
+			 "%d "
+			 "%ld "
+			 "%Lu "  /* start_time */
+			 "%lu "  /* Vsize */
+			 "%ld "  /* Resident size */
+			 "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+			 "%d",	 /* processor */
+			 &P->state,
+			 &P->ppid, &P->pgrp, &P->session, &P->tty, &P->tpgid,
+			 &P->flags, &P->min_flt, &P->cmin_flt, &P->maj_flt, &P->cmaj_flt,
 			 &P->utime, &P->stime, &P->cutime, &P->cstime,
 			 &P->priority, &P->nice,
 			 &P->nlwp,
 			 &P->alarm,
 			 &P->start_time,
 			 &P->vsize,
-			 &P->rss
+			 &P->rss,
+			 &P->processor
 			 );
+	if (num<23)
+	  P->processor = -1;	/* very old kernels */
+	if (P->nodeCpu != P->processor+1)
+	  {
+	    /* Looked up just when it runs on another CPU, not on every copy */
+	    P->node = cpuNode(P->processor);
+	    P->nodeCpu = P->processor+1;
+	  }
+	P->error = (num<22);
+	return !P->error;
+      }
+
+      /** Reads CPU and run queue waiting time (ns) of a process. false if we can't */
+      bool readSchedstat(proc_t* P)
+      {
+	char filename[PATH_MAX];
+	char buffer[128];
+	snprintf(filename, PATH_MAX, "%s/%d/schedstat", _procRoot.c_str(), P->pid);
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	++_statsCounters.syscalls;
+	if (fd == -1)
+	  return false;
+	ssize_t len = readOpenedFile(fd, buffer, sizeof(buffer));
+	close(fd);
+	++_statsCounters.syscalls;
+	return ( (len > 0) && (sscanf(buffer, "%llu %llu", &P->runtime, &P->waittime) == 2) );
+      }
+
+      /** Calculates %CPU from the process start (totalpcpu) and since the last
+	  time it was sampled, timeFromLast seconds ago (pcpu). Times are in
+	  ticks (ticksPerSecond()), or in ns if schedstat was read: then a new
+	  process gets its %CPU since it started, and pwait is calculated too. */
+      /** Seconds since boot with fractions, to get process ages: uptime() has whole
+	  (and cached) seconds, giving young processes a wrong %CPU. CLOCK_BOOTTIME, or
+	  <procRoot>/uptime plus the time since it was read if procRoot() was changed. */
+      double bootTime()
+      {
+	if (_procRoot == "/proc")
+	  {
+	    timespec ts;
+	    if (clock_gettime(CLOCK_BOOTTIME, &ts) == 0)
+	      return ts.tv_sec + ts.tv_nsec / 1e9;
+	  }
+	auto& C = SystemCache;
+	auto now = std::chrono::steady_clock::now();
+	if ( (C.bootTimeRoot != _procRoot) || (C.bootTimeTp+_valueDuration < now) )
+	  {
+	    std::string data = extractFile((_procRoot+"/uptime").c_str(), 32);
+	    C.fileBootTime = 0;
+	    sscanf(data.c_str(), "%lf", &C.fileBootTime);
+	    C.bootTimeTp = now;
+	    C.bootTimeRoot = _procRoot;
+	  }
+	return C.fileBootTime + std::chrono::duration_cast<std::chrono::duration<double>>(now-C.bootTimeTp).count();
+      }
 
-	    procuptime = uptime() - (P->start_time) / 100;
-	    total_time =  P->utime + P->stime; 
-	    P->totalpcpu = (procuptime>0)?((double)total_time / procuptime):0;
-	    if ( (timeFromLast) && (P->oldtime) )
+      void processCpu(proc_t* P, double timeFromLast)
+      {
+	static const double tps = ticksPerSecond();
+	double procuptime = bootTime() - P->start_time / tps;
+	unsigned long long total_time =  P->utime + P->stime;
+	P->totalpcpu = (procuptime>0)?(total_time * 100.0 / tps / procuptime):0;
+	if (P->schedstat)
+	  {
+	    if ( (timeFromLast) && (!P->newproc) )
 	      {
-		P->pcpu=((double)total_time - (double)P->oldtime) / timeFromLast ;
+		P->pcpu = (P->runtime - P->oldRuntime) / 1e7 / timeFromLast;
+		P->pwait = (P->waittime - P->oldWaittime) / 1e7 / timeFromLast;
 	      }
 	    else
-	      P->pcpu=0;
+	      {
+		P->pcpu = (procuptime>0)?(P->runtime / 1e7 / procuptime):0;
+		P->pwait = (procuptime>0)?(P->waittime / 1e7 / procuptime):0;
+	      }
+	    P->oldRuntime = P->runtime;
+	    P->oldWaittime = P->waittime;
+	  }
+	else if ( (timeFromLast) && (!P->newproc) )
+	  {
+	    P->pcpu=((double)total_time - (double)P->oldtime) * 100.0 / tps / timeFromLast;
+	  }
+	else
+	  P->pcpu=0;
+
+	P->oldtime = total_time;
+      }
+
+      /** Fill in process struct with useful information from the contents of its
+       stat file. Even calculate %CPU from last time we read this process. */
+      void storeProcessStat(const char* data, unsigned char update, bool sampled)
+      {
+	uint64_t t1 = (sampled)?statsNow():0, t2=0;
+	auto it = ProcessSummary.processes.find(atoi(data)); /* stat begins with the pid */
+	proc_t* P = (it != ProcessSummary.processes.end())?it->second:NULL;
+	if (P == NULL)
+	  {
+	    P = (proc_t*)calloc(1, sizeof(proc_t));
+	    _statsCounters.allocations+=2; /* proc_t and map node */
+	    P->newproc = 1;
+	    P-> oldtime = 0;
+	  }
+	else
+	  P->newproc = 0;
+
+	unsigned long long oldStart = P->start_time;
+	char oldName[sizeof(P->name)];	/* for events if the pid was reused, and to find exec() */
+	bool grouping = (_grouping != Proc::GROUP_NAME);
+	memcpy(oldName, P->name, sizeof(oldName));
+	ungroupProcess(P, false);
+	if (!parseProcStat(data, P))
+	  {
+	    if (P->newproc)
+	      free(P);
+	    return;
+	  }
+	if (sampled)
+	  t2 = statsNow();
+
+	/* Owner is not in stat: the process directory owner. Read again if the pid was
+	   reused or it called exec() (a new name): setuid programs (su, sshd) change it */
+	bool reused = ( (!P->newproc) && (P->start_time != oldStart) );
+	bool execed = ( (!P->newproc) && (strncmp(oldName, P->name, sizeof(oldName)) != 0) );
+	if ( (P->newproc) || (reused) || (execed) )
+	  {
+	    char dirname[PATH_MAX];
+	    struct stat st;
+	    snprintf(dirname, PATH_MAX, "%s/%d", _procRoot.c_str(), P->pid);
+	    P->uid = (stat(dirname, &st) == 0)?(int)st.st_uid:-1;
+	    ++_statsCounters.syscalls;
+	  }
+	if ( (P->newproc) || (reused) )
+	  {
+	    P->fdSampled = 0;
+	    P->delaysSampled = 0;
+	    /* smaps_rollup values were of the previous process */
+	    P->memSampled = 0;
+	    P->memRss = 0;
+	    P->pss = P->uss = P->swap = 0;
+	  }
+	indexProcess(P, P->newproc);
+	/* Group key is kept until the pid is reused or it calls exec() (a new name) */
+	bool regroup = ( (P->newproc) || (reused) || (execed) );
+
+	/* A process must have both samples in ns to compare them */
+	bool schedstat = ( (_schedstat) && (readSchedstat(P)) );
+	if ( (!P->newproc) && (!reused) && (schedstat != (bool)P->schedstat) )
+	  reused = true;	/* Not the same units: start again */
+	P->schedstat = schedstat;
+	if (!schedstat)
+	  P->pwait = 0;
+
+	/* Each process has its own sample time: they can be read at different times */
+	uint64_t now = statsNow();
+	processCpu(P, ( (P->newproc) || (reused) )?0:(now - P->sampled)/1e9);
+	P->sampled = now;
+	P->updated = update;
+	if (grouping)
+	  groupProcess(P, regroup);
+	ProcessSummary.processes[P->pid] = P;
+	ProcessColumns.valid = false;
+	if (_procEvents)
+	  processEvents(P, oldStart, oldName);
+	if (sampled)
+	  {
+	    _statsScanTime[Stats::PROC_PARSE]+=(t2-t1)*_statsSampleRate;
+	    _statsScanTime[Stats::PROC_UPDATE]+=(statsNow()-t2)*_statsSampleRate;
+	  }
+	//	std::cout << "PID: "<<P->pid<<" - "<<P->name<<"** "<<P->totalpcpu<<"% Intervalo: "<<P->pcpu<<" **"<<std::endl;
+      }
+
+      /** Read a process stat file and store it (see storeProcessStat())  */
+      bool createProcessSummary(char *procId, unsigned char update)
+      {
+	bool sampled = statsSampleThis();
+	uint64_t t0 = (sampled)?statsNow():0;
+	char filename[PATH_MAX];
+	snprintf(filename, PATH_MAX, "%s/%s/stat", _procRoot.c_str(), procId);
+	std::string proc = extractFile(filename);
+	if (sampled)
+	  _statsScanTime[Stats::PROC_READ]+=(statsNow()-t0)*_statsSampleRate;
+	if (proc.empty())
+	  return true;		/* It finished before we could read it */
+
+	storeProcessStat(proc.c_str(), update, sampled);
+	return true;
+      }
+
+      /** Iterate over all processes and call a function with each one.
+       I think it could be useful it we have more things to do with processes
+      not just createProcessSummary() */
+      void walkProcesses(std::function<bool(char*)> f)
+      {
+	/* We use getdents64 directly with a big buffer: less syscalls than readdir()
+	   and we know exactly how many we make. */
+	char buffer[32768];
+	int proc_dir = open(_procRoot.c_str(), O_RDONLY | O_DIRECTORY);
+	++_statsCounters.syscalls;
+	if (proc_dir == -1)
+	  return;
+
+	bool stop = false;
+	long nread;
+	uint64_t start = statsNow();
+	while ( (!stop) && ((nread = syscall(SYS_getdents64, proc_dir, buffer, sizeof(buffer))) > 0) )
+	  {
+	    ++_statsCounters.syscalls;
+	    _statsScanTime[Stats::PROC_READDIR]+=statsNow()-start;
+	    for (long pos = 0; pos<nread; )
+	      {
+		linux_dirent64 *ent = (linux_dirent64*)(buffer+pos);
+		pos+=ent->d_reclen;
+		if ((*ent->d_name>'0') && (*ent->d_name<='9')) /* Be sure it's a pid */
+		  {
+		    if (!f(ent->d_name))
+		      {
+			stop = true;
+			break;
+		      }
+		  }
+	      }
+	    start = statsNow();
+	  }
+	close(proc_dir);
+	_statsCounters.syscalls+=2;	/* last getdents and close */
+      }
+
+#ifdef UMON_IO_URING
+    };
+
+  namespace Internal
+  {
+    /** Minimal io_uring, just what we need: get a submission entry, submit
+	and reap completions. */
+    class Uring
+    {
+    public:
+      Uring(): fd(-1)
+      {
+      }
+
+      ~Uring()
+      {
+	close();
+      }
+
+      bool init(unsigned entries)
+      {
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	fd = syscall(SYS_io_uring_setup, entries, &p);
+	++_statsCounters.syscalls;
+	if (fd == -1)
+	  return false;
+
+	sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+	if (singleMmap)
+	  sqSize = cqSize = std::max(sqSize, cqSize);
+	sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+	sqRing = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	cqRing = (singleMmap)?sqRing:mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	sqes = (io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	_statsCounters.syscalls+=(singleMmap)?2:3;
+	if ( (sqRing == MAP_FAILED) || (cqRing == MAP_FAILED) || (sqes == (io_uring_sqe*)MAP_FAILED) )
+	  {
+	    close();
+	    return false;
+	  }
+
+	char* sq = (char*)sqRing;
+	char* cq = (char*)cqRing;
+	sqHead = (unsigned*)(sq + p.sq_off.head);
+	sqTail = (unsigned*)(sq + p.sq_off.tail);
+	sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	sqEntries = p.sq_entries;
+	sqArray = (unsigned*)(sq + p.sq_off.array);
+	cqHead = (unsigned*)(cq + p.cq_off.head);
+	cqTail = (unsigned*)(cq + p.cq_off.tail);
+	cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+	localTail = *sqTail;
+	queued = 0;
+	return true;
+      }
+
+      bool ready() const
+      {
+	return (fd != -1);
+      }
+
+      /** Next free submission entry (zeroed) or NULL if the ring is full */
+      io_uring_sqe* sqe()
+      {
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if (localTail - head >= sqEntries)
+	  return NULL;
+
+	unsigned idx = localTail & sqMask;
+	io_uring_sqe* e = &sqes[idx];
+	memset(e, 0, sizeof(*e));
+	sqArray[idx] = idx;
+	++localTail;
+	++queued;
+	return e;
+      }
+
+      /** Submit everything queued and wait for waitFor completions. Returns
+	  the entries submitted (the rest stay queued) or -1 (errno) */
+      int submit(unsigned waitFor)
+      {
+	__atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+	int res = syscall(SYS_io_uring_enter, fd, queued, waitFor, (waitFor)?IORING_ENTER_GETEVENTS:0, NULL, 0);
+	++_statsCounters.syscalls;
+	if (res > 0)
+	  queued-=std::min((unsigned)res, queued);
+	return res;
+      }
+
+      /** Pops a completion. false if there are no more */
+      bool cqe(io_uring_cqe& out)
+      {
+	unsigned head = *cqHead;
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+	  return false;
+
+	out = cqes[head & cqMask];
+	__atomic_store_n(cqHead, head+1, __ATOMIC_RELEASE);
+	return true;
+      }
+
+      void close()
+      {
+	if (fd == -1)
+	  return;
+
+	if ( (sqes) && (sqes != (io_uring_sqe*)MAP_FAILED) )
+	  munmap(sqes, sqesSize);
+	if ( (cqRing) && (cqRing != MAP_FAILED) && (!singleMmap) )
+	  munmap(cqRing, cqSize);
+	if ( (sqRing) && (sqRing != MAP_FAILED) )
+	  munmap(sqRing, sqSize);
+	::close(fd);
+	fd = -1;
+	sqes = NULL;
+	sqRing = cqRing = NULL;
+      }
+
+    private:
+      int fd;
+      bool singleMmap;
+      void *sqRing = NULL, *cqRing = NULL;
+      io_uring_sqe* sqes = NULL;
+      size_t sqSize, cqSize, sqesSize;
+      unsigned *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+      unsigned *cqHead, *cqTail, cqMask;
+      io_uring_cqe* cqes;
+      unsigned localTail, queued;
+    };
+
+    /** Batched stat reading. Each batch takes two io_uring_enter() calls:
+	one for the openat() of this batch (and the close() of the last one)
+	and one for the reads. Instead of three syscalls per process. */
+    struct StatBatch_t
+    {
+      enum { SIZE = 256, BUFFER_SIZE = 1024 };
+      enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+      Uring ring;
+      bool unavailable;	/* setup failed or the kernel can't do what we want */
+      int dirfd;
+      unsigned count;
+      unsigned char update;
+      char paths[SIZE][24];
+      int fds[SIZE];
+      int lens[SIZE];
+      int closing[SIZE];
+      unsigned nclosing;
+      char buffers[SIZE][BUFFER_SIZE];
+    };
+  };
 
-	    P->oldtime = total_time;
-	    P->updated = update;
-	    ProcessSummary.processes[P->pid] = P;
+  namespace
+    {
+      using Internal::Uring;
+      Internal::StatBatch_t& StatBatch = Internal::Shared<Internal::StatBatch_t>::value;
+
+      /** Makes sure the ring is there. false if we can't use io_uring */
+      bool statBatchReady()
+      {
+	auto& b = StatBatch;
+	if (b.unavailable)
+	  return false;
+	if ( (!b.ring.ready()) && (!b.ring.init(b.SIZE*2)) )
+	  {
+	    b.unavailable = true;
+	    return false;
+	  }
+	return true;
+      }
+
+      /** Queues close() of the files of the last batch. false if the ring is full
+	  (nothing was submitted: they are still opened) */
+      bool statBatchQueueCloses()
+      {
+	auto& b = StatBatch;
+	for (unsigned i=0; i<b.nclosing; ++i)
+	  {
+	    io_uring_sqe* e = b.ring.sqe();
+	    if (e == NULL)
+	      return false;
+	    e->opcode = IORING_OP_CLOSE;
+	    e->fd = b.closing[i];
+	    e->user_data = (uint64_t)b.OP_CLOSE << 32;
 	  }
-	//	std::cout << "PID: "<<P->pid<<" - "<<P->name<<"** "<<total_time<<" "<<procuptime<<" "<<P->totalpcpu<<"% Intervalo: "<<P->pcpu<<" **"<<std::endl;
 	return true;
       }
 
-      /** Iterate over all processes and call a function with each one.
-       I think it could be useful it we have more things to do with processes
-      not just createProcessSummary() */
-      void walkProcesses(std::function<bool(char*)> f)
+      /** Waits for n completions of the last submit and stores results. false
+	  if io_uring_enter() fails: we can't wait for the rest */
+      bool statBatchReap(unsigned n)
+      {
+	auto& b = StatBatch;
+	io_uring_cqe c;
+	while (n>0)
+	  {
+	    if (!b.ring.cqe(c))
+	      {
+		/* Submits what's still queued too (after a partial submit) */
+		if ( (b.ring.submit(1) < 0) && (errno != EINTR) )
+		  return false;
+		continue;
+	      }
+	    --n;
+	    unsigned op = c.user_data >> 32, i = c.user_data & 0xffffffff;
+	    if (op == b.OP_OPEN)
+	      b.fds[i] = c.res;
+	    else if (op == b.OP_READ)
+	      b.lens[i] = c.res;
+	    else if ( (op == b.OP_CLOSE) && (c.res == -EINVAL) )
+	      b.unavailable = true; /* No IORING_OP_CLOSE (Linux < 5.6) */
+	  }
+	return true;
+      }
+
+      /** io_uring failed: we won't use it anymore. Files known to be opened
+	  (b.closing) are closed the usual way */
+      void statBatchFailed()
+      {
+	auto& b = StatBatch;
+	b.unavailable = true;
+	b.ring.close();
+	for (unsigned i=0; i<b.nclosing; ++i)
+	  close(b.closing[i]);
+	_statsCounters.syscalls+=b.nclosing;
+	b.nclosing = 0;
+      }
+
+      /** Opens, reads and parses the stat files of the processes in the batch */
+      void statBatchFlush()
+      {
+	auto& b = StatBatch;
+	uint64_t start = statsNow();
+	unsigned submitted = b.nclosing + b.count;
+	/* The ring has room for a whole batch and its closes: a full one (NULL entry)
+	   means something went wrong, and what's queued is dropped with the ring */
+	bool failed = !statBatchQueueCloses();
+	for (unsigned i=0; i<b.count; ++i)
+	  {
+	    b.fds[i] = -1;
+	    b.lens[i] = -1;
+	    io_uring_sqe* e = (failed)?NULL:b.ring.sqe();
+	    if (e == NULL)
+	      {
+		failed = true;
+		continue;
+	      }
+	    e->opcode = IORING_OP_OPENAT;
+	    e->fd = b.dirfd;
+	    e->addr = (uint64_t)(uintptr_t)b.paths[i];
+	    e->open_flags = O_RDONLY | O_CLOEXEC;
+	    e->user_data = ((uint64_t)b.OP_OPEN << 32) | i;
+	  }
+	if ( (failed) || (b.ring.submit(submitted) < 0) )
+	  {
+	    /* Nothing submitted: last batch files are still opened */
+	    statBatchFailed();
+	    failed = true;
+	  }
+	else
+	  {
+	    b.nclosing = 0;
+	    failed = !statBatchReap(submitted);
+	    unsigned reads = 0;
+	    for (unsigned i=0; i<b.count; ++i)
+	      {
+		if (b.fds[i] == -EINVAL)
+		  b.unavailable = true; /* No IORING_OP_OPENAT (Linux < 5.6) */
+		if (b.fds[i] < 0)
+		  continue;
+		b.closing[b.nclosing++] = b.fds[i];
+		io_uring_sqe* e = (failed)?NULL:b.ring.sqe();
+		if (e == NULL)
+		  {
+		    failed = true;	/* files are closed the usual way */
+		    continue;
+		  }
+		e->opcode = IORING_OP_READ;
+		e->fd = b.fds[i];
+		e->addr = (uint64_t)(uintptr_t)b.buffers[i];
+		e->len = b.BUFFER_SIZE - 1;
+		e->off = 0;
+		e->user_data = ((uint64_t)b.OP_READ << 32) | i;
+		++reads;
+	      }
+	    if ( (!failed) && (reads) )
+	      failed = ( (b.ring.submit(reads) < 0) || (!statBatchReap(reads)) );
+	    if (failed)
+	      statBatchFailed();
+	  }
+	_statsScanTime[Stats::PROC_READ]+=statsNow()-start;
+
+	for (unsigned i=0; i<b.count; ++i)
+	  {
+	    bool sampled = statsSampleThis();
+	    if ( (b.fds[i] == -EINVAL) || (b.lens[i] == -EINVAL) || (b.lens[i] >= (int)b.BUFFER_SIZE-1) ||
+		 ( (failed) && (b.lens[i] < 0) ) )
+	      {
+		/* io_uring couldn't do it (or failed before reading it), or too long: the usual way */
+		*strchr(b.paths[i], '/') = '\0';
+		createProcessSummary(b.paths[i], b.update);
+	      }
+	    else if (b.lens[i] > 0)
+	      {
+		b.buffers[i][b.lens[i]] = '\0';
+		_statsCounters.bytesRead+=b.lens[i];
+		storeProcessStat(b.buffers[i], b.update, sampled);
+	      }
+	    /* else: it finished before we could read it */
+	  }
+	b.count = 0;
+      }
+
+      /** walkProcesses() callback: adds a process to the batch */
+      bool statBatchAdd(char* procId)
+      {
+	auto& b = StatBatch;
+	if (b.unavailable)
+	  return createProcessSummary(procId, b.update);
+
+	snprintf(b.paths[b.count++], sizeof(b.paths[0]), "%s/stat", procId);
+	if (b.count == b.SIZE)
+	  statBatchFlush();
+	return true;
+      }
+
+      /** Like walkProcesses(createProcessSummary) but reading in batches */
+      bool walkProcessesBatched(unsigned char update)
+      {
+	auto& b = StatBatch;
+	if (!statBatchReady())
+	  return false;
+
+	b.dirfd = open(_procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	++_statsCounters.syscalls;
+	if (b.dirfd == -1)
+	  return false;
+
+	b.count = b.nclosing = 0;
+	b.update = update;
+	walkProcesses(statBatchAdd);
+	if (b.count)
+	  statBatchFlush();
+	if (b.nclosing)
+	  {
+	    /* Last closes. If the ring is gone, the usual way */
+	    if (b.ring.ready())
+	      {
+		unsigned n = b.nclosing;
+		if ( (!statBatchQueueCloses()) || (b.ring.submit(n) < 0) )
+		  statBatchFailed();	/* not submitted: closed the usual way */
+		else
+		  {
+		    b.nclosing = 0;	/* submitted: don't close them twice */
+		    if (!statBatchReap(n))
+		      statBatchFailed();
+		  }
+	      }
+	    else
+	      for (unsigned i=0; i<b.nclosing; ++i)
+		close(b.closing[i]);
+	    b.nclosing = 0;
+	  }
+	close(b.dirfd);
+	++_statsCounters.syscalls;
+	return true;
+      }
+#endif
+
+      /** Cleanup processes not seen in a while (finished processes)  */
+      void processedCleanup()
+      {
+	uint64_t start = statsNow();
+	for (auto i=ProcessSummary.processes.begin(); i!=ProcessSummary.processes.end(); )
+	  {
+	    /* updated wraps around, so we use the age in updates */
+	    unsigned char age = lastProcessUpdate - i->second->updated;
+	    if ( (age == 1) && (_procEvents) && (!i->second->exited) )
+	      {
+		/* Not seen in this update: it has just finished */
+		if (queueEvent(Proc::EVENT_EXITED, i->second))
+		  i->second->exited = 1;
+	      }
+	    if (age > 1) /* No cleanup of just dead processes */
+	      {
+		/* std::cout << "REMOVE: "<<i->second->pid<<std::endl; */
+		unindexProcess(i->second);
+		ungroupProcess(i->second, true);
+		ProcessColumns.valid = false;
+		free(i->second);
+		i = ProcessSummary.processes.erase(i);
+	      }
+	    else
+	      ++i;
+	  }
+	_statsScanTime[Stats::PROC_CLEANUP]+=statsNow()-start;
+      }
+
+      /** Reads PSS, USS and swap of a process from smaps_rollup */
+      void readSmapsRollup(proc_t* P)
+      {
+	static const char* const keys[] = { "Pss:", "Private_Clean:", "Private_Dirty:", "Swap:" };
+	uint64_t pss = 0, privClean = 0, privDirty = 0, swap = 0;
+	uint64_t* const values[] = { &pss, &privClean, &privDirty, &swap };
+	char filename[PATH_MAX];
+
+	snprintf(filename, PATH_MAX, "%s/%d/smaps_rollup", _procRoot.c_str(), P->pid);
+	std::string data = extractFile(filename, 2048);
+	parseKeyValues(data.c_str(), keys, values, 4);
+	P->pss = pss*1024;
+	P->uss = (privClean+privDirty)*1024;
+	P->swap = swap*1024;
+	P->memRss = P->rss;
+	P->memSampled = 1;
+      }
+
+      /** smaps_rollup is expensive (the kernel walks all process mappings), so we
+	  read it while we have time in this refresh, biggest processes first.
+	  Processes whose RSS didn't change keep their last values. */
+      void collectMemoryDetails()
+      {
+	uint64_t start = statsNow();
+	uint64_t deadline = start + std::chrono::duration_cast<std::chrono::nanoseconds>(_memoryDetailsBudget).count();
+	std::vector<proc_t*> pending;
+
+	for (auto p : ProcessSummary.processes)
+	  if ( (!p.second->memSampled) || (p.second->memRss != p.second->rss) )
+	    pending.push_back(p.second);
+	std::sort(pending.begin(), pending.end(), [](const proc_t* a, const proc_t* b) {
+	    return a->rss > b->rss;
+	  });
+
+	for (auto P : pending)
+	  {
+	    if (statsNow() >= deadline)
+	      break;
+	    readSmapsRollup(P);
+	  }
+	statsRecord(Stats::PROC_SMAPS, statsNow()-start);
+      }
+
+      /** Processes whose open files are counted (all of them if empty)  */
+      auto& _openFilesFilter = Internal::Shared<Internal::OpenFiles_t>::value.filter;
+
+      /** Open files soft limit from /proc/<pid>/limits (0 if unlimited or unknown) */
+      int readFdLimit(int pid)
+      {
+	char filename[PATH_MAX];
+	snprintf(filename, PATH_MAX, "%s/%d/limits", _procRoot.c_str(), pid);
+	std::string data = extractFile(filename, 2048);
+	const char* line = strstr(data.c_str(), "Max open files");
+	if (!line)
+	  return 0;
+	return atoi(line+sizeof("Max open files")-1); /* "unlimited" is 0 too */
+      }
+
+      /** Counts /proc/<pid>/fd entries with getdents64 (no readlink() or stat() for each
+	  one). -1 if we can't look into it. */
+      int countFds(int pid, char* buffer, size_t size)
+      {
+	char dirname[PATH_MAX];
+	snprintf(dirname, PATH_MAX, "%s/%d/fd", _procRoot.c_str(), pid);
+	int dir = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	++_statsCounters.syscalls;
+	if (dir == -1)
+	  return -1;
+
+	int count = 0;
+	long nread;
+	while ( (nread = syscall(SYS_getdents64, dir, buffer, size)) > 0 )
+	  {
+	    ++_statsCounters.syscalls;
+	    for (long pos = 0; pos<nread; )
+	      {
+		linux_dirent64 *ent = (linux_dirent64*)(buffer+pos);
+		pos+=ent->d_reclen;
+		if (*ent->d_name != '.')
+		  ++count;
+	      }
+	  }
+	close(dir);
+	_statsCounters.syscalls+=2;	/* last getdents and close */
+	return (nread < 0)?-1:count;
+      }
+
+      /** Counts open files of processes passing the filter. The limit is read the first
+	  time and again when half of it is used (it may have been raised) */
+      void collectOpenFiles()
+      {
+	uint64_t start = statsNow();
+	char buffer[65536];
+
+	for (auto p : ProcessSummary.processes)
+	  {
+	    proc_t* P = p.second;
+	    if (P->updated != lastProcessUpdate)
+	      continue;		/* finished: not seen in this pass */
+	    if ( (_openFilesFilter) && (!_openFilesFilter(singleProc(P))) )
+	      {
+		P->fdSampled = 0;	/* not counted anymore: no stale numbers */
+		continue;
+	      }
+
+	    int fds = countFds(P->pid, buffer, sizeof(buffer));
+	    uint64_t now = statsNow();
+	    if (fds < 0)
+	      {
+		P->fdSampled = 0;
+		continue;
+	      }
+	    if (P->fdSampled)
+	      {
+		P->fdRate = (fds - P->fds)/((now - P->fdSampled)/1e9);
+		P->fdGrowing = (fds > P->fds)?P->fdGrowing+1:0;
+	      }
+	    else
+	      {
+		P->fdRate = 0;
+		P->fdGrowing = 0;
+	      }
+	    if ( (!P->fdSampled) || ( (P->fdLimit > 0) && (fds*2 >= P->fdLimit) ) )
+	      P->fdLimit = readFdLimit(P->pid);
+	    P->fds = fds;
+	    P->fdSampled = now;
+	  }
+	statsRecord(Stats::PROC_FDS, statsNow()-start);
+      }
+
+      Internal::Taskstats_t& TaskstatsSocket = Internal::Shared<Internal::Taskstats_t>::value;
+
+      enum { TASKSTATS_BATCH = Internal::Taskstats_t::BATCH };
+
+      /** Opens the generic netlink socket and asks for the TASKSTATS family id. errno if we can't */
+      int taskstatsOpen()
+      {
+	auto& T = TaskstatsSocket;
+	if (T.opened)
+	  return 0;
+	T.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	++_statsCounters.syscalls;
+	if (T.fd == -1)
+	  return errno;
+
+	struct
+	{
+	  nlmsghdr nlh;
+	  genlmsghdr genl;
+	  nlattr attr;
+	  char name[sizeof(TASKSTATS_GENL_NAME)+3]; /* aligned to 4 */
+	} request;
+	memset(&request, 0, sizeof(request));
+	request.nlh.nlmsg_len = sizeof(request);
+	request.nlh.nlmsg_type = GENL_ID_CTRL;
+	request.nlh.nlmsg_flags = NLM_F_REQUEST;
+	request.nlh.nlmsg_seq = ++T.seq;
+	request.genl.cmd = CTRL_CMD_GETFAMILY;
+	request.genl.version = 1;
+	request.attr.nla_type = CTRL_ATTR_FAMILY_NAME;
+	request.attr.nla_len = NLA_HDRLEN + sizeof(TASKSTATS_GENL_NAME);
+	strcpy(request.name, TASKSTATS_GENL_NAME);
+
+	alignas(nlmsghdr) char buffer[8192];
+	ssize_t nread = -1;
+	if (send(T.fd, &request, sizeof(request), 0) != -1)
+	  nread = recv(T.fd, buffer, sizeof(buffer), 0);
+	_statsCounters.syscalls+=2;
+	int err = (nread == -1)?errno:ENOENT;
+	nlmsghdr* h = (nlmsghdr*)buffer;
+	if ( (nread > 0) && (NLMSG_OK(h, nread)) )
+	  {
+	    if (h->nlmsg_type == NLMSG_ERROR)
+	      err = -((nlmsgerr*)NLMSG_DATA(h))->error;
+	    else
+	      {
+		/* attributes after the generic netlink header */
+		int len = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+		for (nlattr* a = (nlattr*)((char*)NLMSG_DATA(h) + GENL_HDRLEN);
+		     (len >= NLA_HDRLEN) && (a->nla_len >= NLA_HDRLEN) && (a->nla_len <= len);
+		     len-=NLA_ALIGN(a->nla_len), a = (nlattr*)((char*)a + NLA_ALIGN(a->nla_len)))
+		  if (a->nla_type == CTRL_ATTR_FAMILY_ID)
+		    {
+		      T.family = *(uint16_t*)((char*)a + NLA_HDRLEN);
+		      err = 0;
+		    }
+	      }
+	  }
+	if (err)
+	  {
+	    close(T.fd);
+	    ++_statsCounters.syscalls;
+	    return err;
+	  }
+	T.opened = true;
+	return 0;
+      }
+
+      /** Delays from a taskstats reply. Its struct grows with kernel versions, we
+	  take what we know of */
+      void taskstatsDelays(const char* data, int len, Proc::Delays& delays)
+      {
+	struct taskstats ts;
+	memset(&ts, 0, sizeof(ts));
+	memcpy(&ts, data, std::min((size_t)len, sizeof(ts)));
+	delays.cpu = ts.cpu_delay_total;
+	delays.blkio = ts.blkio_delay_total;
+	delays.swapin = ts.swapin_delay_total;
+	delays.reclaim = ts.freepages_delay_total;
+      }
+
+      /** Looks for TASKSTATS_TYPE_STATS in a reply (inside TASKSTATS_TYPE_AGGR_PID/TGID) */
+      bool taskstatsReply(nlmsghdr* h, Proc::Delays& delays)
+      {
+	int len = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	nlattr* a = (nlattr*)((char*)NLMSG_DATA(h) + GENL_HDRLEN);
+	while ( (len >= NLA_HDRLEN) && (a->nla_len >= NLA_HDRLEN) && (a->nla_len <= len) )
+	  {
+	    if ( (a->nla_type == TASKSTATS_TYPE_AGGR_PID) || (a->nla_type == TASKSTATS_TYPE_AGGR_TGID) )
+	      {
+		/* nested: go inside */
+		len = a->nla_len - NLA_HDRLEN;
+		a = (nlattr*)((char*)a + NLA_HDRLEN);
+		continue;
+	      }
+	    if (a->nla_type == TASKSTATS_TYPE_STATS)
+	      {
+		taskstatsDelays((char*)a + NLA_HDRLEN, a->nla_len - NLA_HDRLEN, delays);
+		return true;
+	      }
+	    len-=NLA_ALIGN(a->nla_len);
+	    a = (nlattr*)((char*)a + NLA_ALIGN(a->nla_len));
+	  }
+	return false;
+      }
+
+      /** Asks for delays of some pids (thread groups or single threads), TASKSTATS_BATCH
+	  requests in one send() and their replies in one recvmmsg(). f(index, delays, error)
+	  is called for each pid. Returns errno if the socket can't be used */
+      template <typename F>
+      int taskstatsQuery(const int* pids, size_t n, bool threadGroup, F f)
+      {
+	auto& T = TaskstatsSocket;
+	int err = taskstatsOpen();
+	if (err)
+	  return err;
+
+	struct TaskstatsRequest
+	{
+	  nlmsghdr nlh;
+	  genlmsghdr genl;
+	  nlattr attr;
+	  uint32_t pid;
+	};
+	TaskstatsRequest requests[TASKSTATS_BATCH];
+	auto& buffers = T.buffers;
+	iovec iov[TASKSTATS_BATCH];
+	mmsghdr msgs[TASKSTATS_BATCH];
+
+	for (size_t first = 0; first < n; first+=TASKSTATS_BATCH)
+	  {
+	    size_t count = std::min(n-first, (size_t)TASKSTATS_BATCH);
+	    uint32_t seq = T.seq+1;
+	    memset(requests, 0, sizeof(requests));
+	    for (size_t i=0; i<count; ++i)
+	      {
+		TaskstatsRequest& r = requests[i];
+		r.nlh.nlmsg_len = sizeof(r);
+		r.nlh.nlmsg_type = T.family;
+		r.nlh.nlmsg_flags = NLM_F_REQUEST;
+		r.nlh.nlmsg_seq = seq+i;
+		r.genl.cmd = TASKSTATS_CMD_GET;
+		r.genl.version = TASKSTATS_GENL_VERSION;
+		r.attr.nla_type = (threadGroup)?TASKSTATS_CMD_ATTR_TGID:TASKSTATS_CMD_ATTR_PID;
+		r.attr.nla_len = NLA_HDRLEN + sizeof(uint32_t);
+		r.pid = pids[first+i];
+	      }
+	    T.seq+=count;
+	    ++_statsCounters.syscalls;
+	    if (send(T.fd, requests, count*sizeof(TaskstatsRequest), 0) == -1)
+	      return errno;
+
+	    /* One reply for each request: stats or an error (ESRCH if it finished) */
+	    size_t replies = 0;
+	    while (replies < count)
+	      {
+		for (size_t i=0; i<count-replies; ++i)
+		  {
+		    iov[i].iov_base = buffers[i];
+		    iov[i].iov_len = sizeof(buffers[i]);
+		    memset(&msgs[i], 0, sizeof(msgs[i]));
+		    msgs[i].msg_hdr.msg_iov = &iov[i];
+		    msgs[i].msg_hdr.msg_iovlen = 1;
+		  }
+		int received = recvmmsg(T.fd, msgs, count-replies, MSG_WAITFORONE, NULL);
+		++_statsCounters.syscalls;
+		if (received == -1)
+		  {
+		    if (errno == EINTR)
+		      continue;
+		    return errno;
+		  }
+		for (int m=0; m<received; ++m)
+		  {
+		    nlmsghdr* h = (nlmsghdr*)buffers[m];
+		    int len = msgs[m].msg_len;
+		    _statsCounters.bytesRead+=len;
+		    if ( (!NLMSG_OK(h, len)) || (h->nlmsg_seq - seq >= count) )
+		      continue;	/* not for this batch */
+		    ++replies;
+		    Proc::Delays delays;
+		    memset(&delays, 0, sizeof(delays));
+		    if (h->nlmsg_type == NLMSG_ERROR)
+		      f(first + h->nlmsg_seq - seq, delays, -((nlmsgerr*)NLMSG_DATA(h))->error);
+		    else
+		      f(first + h->nlmsg_seq - seq, delays, (taskstatsReply(h, delays))?0:ENODATA);
+		  }
+	      }
+	  }
+	return 0;
+      }
+
+      /** Processes whose delays are read (all of them if empty)  */
+      auto& _delaysFilter = TaskstatsSocket.filter;
+
+      /** Reads delays of processes passing the filter, all of them in batches  */
+      void collectDelays()
+      {
+	uint64_t start = statsNow();
+	std::vector<int> pids;
+	std::vector<proc_t*> procs;
+	std::vector<unsigned char> sampled;
+	for (auto p : ProcessSummary.processes)
+	  {
+	    proc_t* P = p.second;
+	    if (P->updated != lastProcessUpdate)
+	      continue;		/* finished: not seen in this pass */
+	    if ( (!_delaysFilter) || (_delaysFilter(singleProc(P))) )
+	      {
+		pids.push_back(P->pid);
+		procs.push_back(P);
+		sampled.push_back(P->delaysSampled);
+	      }
+	    /* Unsampled until its reply comes: filtered out processes, errors and a failed
+	       query don't keep old delays */
+	    P->delaysSampled = 0;
+	    memset(&P->delaysDelta, 0, sizeof(P->delaysDelta));
+	  }
+	taskstatsQuery(pids.data(), pids.size(), true, [&procs, &sampled](size_t i, const Proc::Delays& delays, int error) {
+	    proc_t* P = procs[i];
+	    if (error)
+	      return;
+	    if (sampled[i])
+	      {
+		P->delaysDelta.cpu = delays.cpu - P->delays.cpu;
+		P->delaysDelta.blkio = delays.blkio - P->delays.blkio;
+		P->delaysDelta.swapin = delays.swapin - P->delays.swapin;
+		P->delaysDelta.reclaim = delays.reclaim - P->delays.reclaim;
+	      }
+	    P->delays = delays;
+	    P->delaysSampled = 1;
+	  });
+	statsRecord(Stats::PROC_DELAYS, statsNow()-start);
+      }
+    };
+
+  /** Processes public functions  */
+ namespace Proc
+ {
+   /** build process internal summary. Many functions will build the entire process summary
+       as it isn't too expensive, save programming time and these functions won't be used just
+       once for a single process. My intention is to iterate over processes each time. */
+   static void buildProcSummary(bool reload=false)
+   {
+     std::chrono::steady_clock::time_point& _procsum_tp = ProcessSummary.lastBuild;
+     auto now = std::chrono::steady_clock::now();
+     if ( (reload) || (_procsum_tp+proccessSummaryRebuild < now) )
+       {
+	 _statsScanTime = StatsState.buildTime;
+	 memset(_statsScanTime, 0, sizeof(StatsState.buildTime));
+	 ++lastProcessUpdate;
+#ifdef UMON_IO_URING
+	 if ( (!_ioUring) || (!walkProcessesBatched(lastProcessUpdate)) )
+#endif
+	   walkProcesses(std::bind(createProcessSummary, std::placeholders::_1, lastProcessUpdate));
+	 processedCleanup();
+	 if (_memoryDetails)
+	   collectMemoryDetails();
+	 if (_openFiles)
+	   collectOpenFiles();
+	 if (_delays)
+	   collectDelays();
+	 _procsum_tp = std::chrono::steady_clock::now();
+	 ++_statsCounters.refreshes;
+	 for (int stage = Stats::PROC_READDIR; stage<=Stats::PROC_CLEANUP; ++stage)
+	   statsRecord((Stats::Stage)stage, _statsScanTime[stage]);
+	 statsRecord(Stats::PROC, std::chrono::duration_cast<std::chrono::nanoseconds>(_procsum_tp-now).count());
+	 notifyRefresh(REFRESH_PROC);
+       }
+
+     ProcessSummary.generationTime = (std::chrono::steady_clock::now() - now);
+   }
+
+   /** Incremental process scan, for systems with lots of processes. Walks /proc for
+       budget seconds at most and next call resumes where this one stopped. New
+       processes and processes over scanActiveThreshold() %CPU are read every pass,
+       idle ones every scanIdleInterval(). %CPU is right anyway, as every process
+       has its own sample time. When a pass finishes, finished processes are
+       cleaned up and the summary is considered built (so access functions won't
+       build it again). Returns true when a pass finished in this call. */
+   static bool scanStep(double budget)
+   {
+     auto& sc = IncrementalScan;
+     uint64_t start = statsNow();
+     uint64_t deadline = start + (uint64_t)(budget*1e9);
+     uint64_t idleNs = std::chrono::duration_cast<std::chrono::nanoseconds>(_scanIdleInterval).count();
+     bool completed = false;
+
+     if ( (sc.fd != -1) && (sc.root != _procRoot) )
+       {
+	 /* procRoot() changed: start a pass over the new one */
+	 close(sc.fd);
+	 ++_statsCounters.syscalls;
+	 sc.fd = -1;
+       }
+     if (sc.fd == -1)
+       {
+	 sc.root = _procRoot;
+	 sc.fd = open(_procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	 ++_statsCounters.syscalls;
+	 if (sc.fd == -1)
+	   return false;
+	 sc.nread = sc.pos = 0;
+	 sc.passStarted = false;
+       }
+     _statsScanTime = StatsState.stepTime;
+     if (!sc.passStarted)
+       {
+	 ++lastProcessUpdate;
+	 memset(_statsScanTime, 0, sizeof(StatsState.stepTime));
+	 sc.passStart = std::chrono::steady_clock::now();
+	 sc.passStarted = true;
+       }
+
+     while (true)
+       {
+	 if (sc.pos >= sc.nread)
+	   {
+	     uint64_t readdirStart = statsNow();
+	     sc.nread = syscall(SYS_getdents64, sc.fd, sc.buffer, sizeof(sc.buffer));
+	     sc.pos = 0;
+	     ++_statsCounters.syscalls;
+	     _statsScanTime[Stats::PROC_READDIR]+=statsNow()-readdirStart;
+	     if (sc.nread <= 0)
+	       {
+		 /* Pass finished. Next one will start from the beginning */
+		 sc.nread = 0;
+		 sc.passStarted = false;
+		 lseek(sc.fd, 0, SEEK_SET);
+		 ++_statsCounters.syscalls;
+		 processedCleanup();
+		 if (_memoryDetails)
+		   collectMemoryDetails();
+		 if (_openFiles)
+		   collectOpenFiles();
+		 if (_delays)
+		   collectDelays();
+		 ProcessSummary.lastBuild = std::chrono::steady_clock::now();
+		 ProcessSummary.generationTime = ProcessSummary.lastBuild - sc.passStart;
+		 ++_statsCounters.refreshes;
+		 for (int stage = Stats::PROC_READDIR; stage<=Stats::PROC_CLEANUP; ++stage)
+		   statsRecord((Stats::Stage)stage, _statsScanTime[stage]);
+		 statsRecord(Stats::PROC, std::chrono::duration_cast<std::chrono::nanoseconds>(ProcessSummary.generationTime).count());
+		 notifyRefresh(REFRESH_PROC);
+		 completed = true;
+		 break;
+	       }
+	   }
+
+	 linux_dirent64 *ent = (linux_dirent64*)(sc.buffer+sc.pos);
+	 sc.pos+=ent->d_reclen;
+	 if ((*ent->d_name<='0') || (*ent->d_name>'9')) /* Be sure it's a pid */
+	   continue;
+
+	 uint64_t now = statsNow();
+	 auto it = ProcessSummary.processes.find(atoi(ent->d_name));
+	 if (it != ProcessSummary.processes.end())
+	   {
+	     proc_t* P = it->second;
+	     if ( (P->pcpu < _scanActiveThreshold) && (now - P->sampled < idleNs) )
+	       {
+		 /* Idle and read not long ago. It's still there, that's all */
+		 P->updated = lastProcessUpdate;
+		 if (now >= deadline)
+		   break;
+		 continue;
+	       }
+	   }
+	 createProcessSummary(ent->d_name, lastProcessUpdate);
+	 if (statsNow() >= deadline)
+	   break;
+       }
+
+     statsRecord(Stats::PROC_STEP, statsNow()-start);
+     return completed;
+   }
+
+   /** Process events getter/setter. When enabled, every time processes are read
+       (buildProcSummary() or scanStep()) events are queued for processes started,
+       finished (found missing) and changed: %CPU or RSS beyond a threshold, or
+       state. Disabled by default. Processes known when it's enabled don't
+       generate EVENT_STARTED. */
+   static bool trackEvents()
+   {
+     return _procEvents;
+   }
+
+   static bool trackEvents(bool val)
+   {
+     if ( (val) && (!_procEvents) )
+       {
+	 for (auto p : ProcessSummary.processes)
+	   eventBaseline(p.second);
+       }
+     _procEvents = val;
+     if (!val)
+       ProcessEvents.clear();
+     return _procEvents;
+   }
+
+   /** %CPU change (points) generating an EVENT_CHANGED event getter/setter (0 = never) */
+   static double eventPcpuThreshold()
+   {
+     return _eventPcpuThreshold;
+   }
+
+   static double eventPcpuThreshold(double val)
+   {
+     return (_eventPcpuThreshold = val);
+   }
+
+   /** RSS change (pages) generating an EVENT_CHANGED event getter/setter (0 = never) */
+   static long eventRssThreshold()
+   {
+     return _eventRssThreshold;
+   }
+
+   static long eventRssThreshold(long val)
+   {
+     return (_eventRssThreshold = val);
+   }
+
+   /** Max queued events getter/setter. Events over it are dropped (see eventsDropped()) */
+   static size_t eventQueueLimit()
+   {
+     return _eventQueueLimit;
+   }
+
+   static size_t eventQueueLimit(size_t val)
+   {
+     return (_eventQueueLimit = val);
+   }
+
+   /** Events dropped because the queue was full */
+   static unsigned long eventsDropped()
+   {
+     return _eventsDropped;
+   }
+
+   /** Queued events, oldest first. They are there until takeEvents() */
+   static const std::vector<Event>& events()
+   {
+     return ProcessEvents;
+   }
+
+   /** Moves queued events to out (its contents are replaced). Passing the same
+       vector each time, no memory is allocated once both have grown enough.
+       Returns the number of events. */
+   static size_t takeEvents(std::vector<Event>& out)
+   {
+     out.clear();
+     out.swap(ProcessEvents);
+     return out.size();
+   }
+
+   /** schedstat getter/setter. When enabled, /proc/<pid>/schedstat is read too
+       (one more file per process): %CPU comes from CPU time in ns instead of
+       clock ticks, so it's accurate for short intervals, new processes get
+       their %CPU since they started instead of 0, and pwait has the % of time
+       waiting in a run queue (the process could run, but no CPU was free).
+       Needs CONFIG_SCHED_INFO (schedstats are on by default). */
+   static bool schedstat()
+   {
+     return _schedstat;
+   }
+
+   static bool schedstat(bool val)
+   {
+     return (_schedstat = val);
+   }
+
+   /** io_uring getter/setter. When enabled, buildProcSummary() reads stat files
+       in batches (two syscalls per 256 processes). It will be false if io_uring
+       can't be used (old kernel, disabled or seccomp), then files are read
+       the usual way. */
+   static bool ioUring()
+   {
+     return _ioUring;
+   }
+
+   static bool ioUring(bool val)
+   {
+#ifdef UMON_IO_URING
+     _ioUring = ( (val) && (statBatchReady()) );
+#else
+     _ioUring = false;
+#endif
+     return _ioUring;
+   }
+
+   /* scan idle interval getter/s (seconds). See scanStep() */
+   static double scanIdleInterval()
+   {
+     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(_scanIdleInterval).count();
+   }
+
+   static double scanIdleInterval(double val)
+   {
+     _scanIdleInterval = std::chrono::milliseconds(static_cast<unsigned long>(val * 1000));
+     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(_scanIdleInterval).count();
+   }
+
+   /* scan active threshold getter/s (%CPU). See scanStep() */
+   static double scanActiveThreshold()
+   {
+     return _scanActiveThreshold;
+   }
+
+   static double scanActiveThreshold(double val)
+   {
+     _scanActiveThreshold = val;
+     return _scanActiveThreshold;
+   }
+
+   /** build advanced process summary. Automatically calls buildProcSummary()  */
+   static void buildAdvancedSummary(bool reload=false)
+   {
+     buildProcSummary(reload);
+     std::chrono::steady_clock::time_point& _procsum_tp = ProcessSummary.lastAdvanced;
+     auto now = std::chrono::steady_clock::now();
+     if ( (reload) || (_procsum_tp+proccessSummaryRebuild < now) )
+       {
+	 uint64_t start = statsNow();
+	 ProcessSummary.advanced.clear();
+	 for (auto p : ProcessSummary.processes)
+	   {
+	     auto _p = p.second;
+	     SingleProc sp = singleProc(_p);
+	     auto item = ProcessSummary.advanced.find(_p->name);
+	     if (item == ProcessSummary.advanced.end())
+	       {
+		 MultiProc mp({_p->name, _p->pcpu, _p->totalpcpu, _p->vsize,
+		       _p->rss, 1, std::map<unsigned, SingleProc>(), _p->pss, _p->uss, _p->swap, _p->pwait,
+		       _p->delays, _p->delaysDelta});
+		 mp.processes[_p->pid] = sp;
+		 ProcessSummary.advanced[_p->name] = mp;
+	       }
+	     else
+	       {
+		 item->second.pcpu+=_p->pcpu;
+		 item->second.totalpcpu+=_p->totalpcpu;
+		 item->second.pwait+=_p->pwait;
+		 item->second.totalvsize+=_p->vsize;
+		 item->second.totalrss+=_p->rss;
+		 item->second.totalpss+=_p->pss;
+		 item->second.totaluss+=_p->uss;
+		 item->second.totalswap+=_p->swap;
+		 item->second.totaldelays+=_p->delays;
+		 item->second.totaldelaysDelta+=_p->delaysDelta;
+		 ++item->second.count;
+		 item->second.processes[_p->pid] = sp;
+	       }
+	   }
+	 statsRecord(Stats::PROC_ADVANCED, statsNow()-start);
+       }
+   }
+
+   /* memory details getter/s. When enabled, PSS, USS and swap are read from
+      smaps_rollup while building process summary. */
+   static bool memoryDetails()
+   {
+     return _memoryDetails;
+   }
+
+   static bool memoryDetails(bool val)
+   {
+     _memoryDetails = val;
+     return _memoryDetails;
+   }
+
+   /* memory details time budget getter/s (seconds per process summary). */
+   static double memoryDetailsBudget()
+   {
+     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(_memoryDetailsBudget).count();
+   }
+
+   static double memoryDetailsBudget(double val)
+   {
+     _memoryDetailsBudget = std::chrono::microseconds(static_cast<unsigned long>(val * 1000000));
+     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(_memoryDetailsBudget).count();
+   }
+
+   /** open files getter/s. When enabled, /proc/<pid>/fd entries of processes passing
+      openFilesFilter() are counted while building process summary. */
+   static bool openFiles()
+   {
+     return _openFiles;
+   }
+
+   static bool openFiles(bool val)
+   {
+     _openFiles = val;
+     if (!val)
+       for (auto p : ProcessSummary.processes)
+	 p.second->fdSampled = 0;	/* counts would get stale */
+     return _openFiles;
+   }
+
+   /** Just count open files of processes f() returns true for (e.g. by name or uid).
+       An empty function counts all of them. */
+   static void openFilesFilter(std::function<bool(const SingleProc&)> f)
+   {
+     _openFilesFilter = f;
+   }
+
+   /** delays getter/s. When enabled, delay accounting totals of processes passing
+      delaysFilter() are asked to taskstats while building process summary. */
+   static bool delays()
+   {
+     return _delays;
+   }
+
+   static bool delays(bool val)
+   {
+     _delays = val;
+     if (!val)
+       for (auto p : ProcessSummary.processes)
+	 {
+	   p.second->delaysSampled = 0;	/* deltas would get stale */
+	   memset(&p.second->delaysDelta, 0, sizeof(p.second->delaysDelta));
+	 }
+     return _delays;
+   }
+
+   /** Just read delays of processes f() returns true for. An empty function reads
+       all of them. */
+   static void delaysFilter(std::function<bool(const SingleProc&)> f)
+   {
+     _delaysFilter = f;
+   }
+
+   /** Returns time taken to build the summary  */
+   static double timeToBuildSummary()
+   {
+     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(ProcessSummary.generationTime).count();
+   }
+
+   /** another process count, this time with our process map  */
+   static unsigned processCount()
+   {
+     buildProcSummary();
+     return ProcessSummary.processes.size();
+   }
+
+   /** count processes with given name  */
+   static unsigned countProcess(std::string name)
+   {
+     buildProcSummary();
+     buildAdvancedSummary();
+
+     auto it = ProcessSummary.advanced.find(name);
+     if (it == ProcessSummary.advanced.end())
+       return 0;
+     return it->second.count;
+   }
+
+   /** total %CPU by a given process. If allTime is true, the % will be
+       calculated from the process start. If not, it will be calculated from
+       the last call to any process function (as it uses buildProcSummary). */
+   static double totalPCPU(std::string name, bool allTime=false)
+   {
+     buildProcSummary();
+     buildAdvancedSummary();
+
+     auto it = ProcessSummary.advanced.find(name);
+     if (it == ProcessSummary.advanced.end())
+       return 0;
+
+     return (allTime)?it->second.totalpcpu:it->second.pcpu;
+   }
+
+   /** Process metrics in columns (see Columns). Pointers are valid until
+       processes are read again (buildProcSummary(), scanStep()...) */
+   static Columns columns()
+   {
+     buildProcSummary();
+     buildColumns();
+     auto& c = ProcessColumns;
+     return Columns({c.rows.size(), c.pid.data(), c.pcpu.data(), c.totalpcpu.data(),
+	   c.vsize.data(), c.rss.data(), c.state.data()});
+   }
+
+   /** Rows of columns() matching all predicates (AND) and sums of the columns
+       in sums (bitmask of 1<<COLUMN_x) over them, in a single pass. e.g:
+       count and RSS of running processes over 5% CPU:
+	 Predicate where[] = { { COLUMN_PCPU, CMP_GT, 5 }, { COLUMN_STATE, CMP_EQ, STATE_RUNNING } };
+	 auto r = query(where, 2, 1<<COLUMN_RSS);  // r.count, r.sum[COLUMN_RSS] */
+   static QueryResult query(const Predicate* where, size_t npred, unsigned sums=0)
+   {
+     QueryResult result;
+     buildProcSummary();
+     buildColumns();
+     columnQuery(where, npred, sums, result);
+     return result;
+   }
+
+   static QueryResult query(const std::vector<Predicate>& where, unsigned sums=0)
+   {
+     return query(where.data(), where.size(), sums);
+   }
+
+   /** Processes selected (as in query().selection) */
+   static std::vector<SingleProc> selected(const Selection& selection)
+   {
+     std::vector<SingleProc> result;
+     buildColumns();
+     auto& rows = ProcessColumns.rows;
+     for (size_t w=0; w<selection.bits.size(); ++w)
+       {
+	 for (uint64_t word = selection.bits[w]; word; word &= word-1)
+	   {
+	     size_t row = w*64 + __builtin_ctzll(word);
+	     if (row < rows.size())
+	       result.push_back(singleProc(rows[row]));
+	   }
+       }
+
+     return result;
+   }
+
+   /** Get all processes with a given name in a MultiProc  */
+   static MultiProc getByName(std::string name)
+   {
+     buildAdvancedSummary();
+     return ProcessSummary.advanced[name];
+   }
+
+   /** Get all processes information */
+   static std::map<unsigned, SingleProc> getAllProcs()
+   {
+     std::map<unsigned, SingleProc> result;
+     buildProcSummary();
+
+     for (auto p : ProcessSummary.processes)
+       {
+	 auto _p = p.second;
+	 SingleProc sp = singleProc(_p);
+	 result[_p->pid] = sp;
+       }
+     return result;
+   }
+
+   /** Gets all process over a %CPU threshold  */
+   static std::vector<SingleProc> getByPCPU(double threshold, bool allTime=false)
+   {
+     Predicate where = { (allTime)?COLUMN_TOTALPCPU:COLUMN_PCPU, CMP_GE, threshold };
+     return selected(query(&where, 1, 0).selection);
+   }
+
+   /** Gets all process over a %CPU threshold (counting all processes with the same name)  */
+   static std::map<std::string, MultiProc> getByPCPUCol(double threshold, bool allTime=false)
+   {
+     std::map<std::string, MultiProc> result;
+     buildAdvancedSummary();
+
+     for (auto& p : ProcessSummary.advanced)
+       {
+	 auto _p = p.second;
+
+	 if (allTime)
+	   {
+	     if (_p.totalpcpu >=threshold)
+	       result[p.first] = p.second;
+	   }
+	 else
+	   {
+	     if (_p.pcpu >=threshold)
+	       result[p.first] = p.second;
+	   }
+       }
+
+     return result;
+   }
+
+   /** Gets all process over a Vsize threshold */
+   static std::vector<SingleProc> getByVsize(unsigned long threshold)
+   {
+     Predicate where = { COLUMN_VSIZE, CMP_GE, (double)threshold };
+     return selected(query(&where, 1, 0).selection);
+   }
+
+   /** Gets all processes with a given value of an index. Just visits those processes */
+   static std::vector<SingleProc> getByIndex(Index index, int value)
+   {
+     std::vector<SingleProc> result;
+     if ( (index < 0) || (index >= INDEX_COUNT) )
+       return result;
+     buildProcSummary();
+
+     auto bucket = ProcessIndex[index].find(value);
+     if (bucket == ProcessIndex[index].end())
+       return result;
+
+     result.reserve(bucket->second.size());
+     for (auto pid : bucket->second)
+       {
+	 auto p = ProcessSummary.processes.find(pid);
+	 if (p != ProcessSummary.processes.end())
+	   result.push_back(singleProc(p->second));
+       }
+
+     return result;
+   }
+
+   /** Number of processes for each value of an index */
+   static std::map<int, unsigned> indexCounts(Index index)
+   {
+     std::map<int, unsigned> result;
+     if ( (index < 0) || (index >= INDEX_COUNT) )
+       return result;
+     buildProcSummary();
+
+     for (auto& bucket : ProcessIndex[index])
+       result[bucket.first] = bucket.second.size();
+
+     return result;
+   }
+
+   /** Number of processes with a given value of an index */
+   static unsigned indexCount(Index index, int value)
+   {
+     if ( (index < 0) || (index >= INDEX_COUNT) )
+       return 0;
+     buildProcSummary();
+
+     auto bucket = ProcessIndex[index].find(value);
+     return (bucket == ProcessIndex[index].end())?0:bucket->second.size();
+   }
+
+   /** Gets all processes in a state (STATE_RUNNING, STATE_ZOMBIE...) */
+   static std::vector<SingleProc> getByState(char state)
+   {
+     return getByIndex(INDEX_STATE, state);
+   }
+
+   /** Number of processes in a state */
+   static unsigned countByState(char state)
+   {
+     return indexCount(INDEX_STATE, state);
+   }
+
+   /** Number of processes in each state */
+   static std::map<char, unsigned> stateCounts()
+   {
+     std::map<char, unsigned> result;
+     for (auto s : indexCounts(INDEX_STATE))
+       result[(char)s.first] = s.second;
+
+     return result;
+   }
+
+   /** Gets all processes owned by a user */
+   static std::vector<SingleProc> getByUid(int uid)
+   {
+     return getByIndex(INDEX_UID, uid);
+   }
+
+   /** Number of processes owned by a user */
+   static unsigned countByUid(int uid)
+   {
+     return indexCount(INDEX_UID, uid);
+   }
+
+   /** Number of processes of each user */
+   static std::map<int, unsigned> uidCounts()
+   {
+     return indexCounts(INDEX_UID);
+   }
+
+   /** Gets all processes with a controlling terminal (tty_nr, 0 = none) */
+   static std::vector<SingleProc> getByTty(int tty)
+   {
+     return getByIndex(INDEX_TTY, tty);
+   }
+
+   /** Gets all processes in a session */
+   static std::vector<SingleProc> getBySession(int session)
+   {
+     return getByIndex(INDEX_SESSION, session);
+   }
+
+   /** Gets all processes in a process group */
+   static std::vector<SingleProc> getByPgrp(int pgrp)
+   {
+     return getByIndex(INDEX_PGRP, pgrp);
+   }
+
+   /** grouping getter/s. Processes are kept in groups (by PID namespace, cgroup
+      or container) while scanning, with their totals updated as each process
+      is read: no extra pass to get them. A process' key is found when it's
+      first seen and again if it calls exec(). Changing it groups all processes
+      again. */
+   static Grouping grouping()
+   {
+     return (Grouping)_grouping;
+   }
+
+   static Grouping grouping(Grouping val)
+   {
+     if (val == _grouping)
+       return val;
+     for (auto p : ProcessSummary.processes)
+       {
+	 p.second->group = 0;
+	 p.second->grouped = 0;
+       }
+     ProcessGroups.groups.clear();
+     ProcessGroups.ids.clear();
+     ProcessGroups.unused.clear();
+     _grouping = val;
+     if (val != GROUP_NAME)
+       for (auto p : ProcessSummary.processes)
+	 groupProcess(p.second, true);
+     return val;
+   }
+
+   /** All groups with processes (see grouping()), by key  */
+   static std::map<std::string, Group> groups()
+   {
+     std::map<std::string, Group> result;
+     buildProcSummary();
+
+     for (auto& g : ProcessGroups.groups)
+       if (!g.pids.empty())
+	 result[g.key] = g;
+
+     return result;
+   }
+
+   /** A group (see grouping()). count is 0 if there are no processes in it */
+   static Group group(std::string key)
+   {
+     buildProcSummary();
+     auto id = ProcessGroups.ids.find(key);
+     if (id != ProcessGroups.ids.end())
+       return ProcessGroups.groups[id->second];
+
+     Group g = Group();
+     g.key = key;
+     return g;
+   }
+
+   /** Group key of a process (see grouping()). Empty if we don't know it */
+   static std::string groupOf(unsigned pid)
+   {
+     buildProcSummary();
+     auto p = ProcessSummary.processes.find(pid);
+     if ( (p == ProcessSummary.processes.end()) || (!p->second->group) )
+       return std::string();
+     return ProcessGroups.groups[p->second->group].key;
+   }
+
+   /** Gets all processes in a group (see grouping())  */
+   static std::vector<SingleProc> getByGroup(std::string key)
+   {
+     std::vector<SingleProc> result;
+     buildProcSummary();
+
+     auto id = ProcessGroups.ids.find(key);
+     if (id == ProcessGroups.ids.end())
+       return result;
+     for (auto pid : ProcessGroups.groups[id->second].pids)
+       {
+	 auto p = ProcessSummary.processes.find(pid);
+	 if (p != ProcessSummary.processes.end())
+	   result.push_back(singleProc(p->second));
+       }
+
+     return result;
+   }
+
+   /** Gets all process over a Vsize threshold (counting all processes with the same name) */
+   static std::map<std::string, MultiProc> getByVsizeCol(unsigned long long threshold)
+   {
+     std::map<std::string, MultiProc> result;
+     buildAdvancedSummary();
+
+     for (auto& p : ProcessSummary.advanced)
+       {
+	 auto _p = p.second;
+
+	 if (_p.totalvsize >= threshold)
+	   result[p.first] = p.second;
+       }
+
+     return result;
+   }
+
+   /** Gets all processes using at least a ratio of their open files limit
+       (0.9 = 90% of RLIMIT_NOFILE). Needs openFiles() */
+   static std::vector<SingleProc> getByFdUsageRatio(double threshold)
+   {
+     std::vector<SingleProc> result;
+     buildProcSummary();
+
+     for (auto p : ProcessSummary.processes)
+       {
+	 auto _p = p.second;
+	 if ( (_p->fdSampled) && (_p->fdLimit > 0) && (_p->fds >= threshold*_p->fdLimit) )
+	   result.push_back(singleProc(_p));
+       }
+
+     return result;
+   }
+
+   /** Gets all processes whose open files grew at least rate per second in
+       the last count, and grew in the last refreshes counts in a row (a leak
+       grows every time). Needs openFiles() */
+   static std::vector<SingleProc> getByFdGrowth(double rate, unsigned refreshes=1)
+   {
+     std::vector<SingleProc> result;
+     buildProcSummary();
+
+     for (auto p : ProcessSummary.processes)
+       {
+	 auto _p = p.second;
+	 if ( (_p->fdSampled) && (_p->fdRate >= rate) && (_p->fdGrowing >= refreshes) )
+	   result.push_back(singleProc(_p));
+       }
+
+     return result;
+   }
+
+   /** Gets all processes that waited at least ns (CPU, block I/O, swap in and
+       reclaim delays together) since the previous refresh. Needs delays() */
+   static std::vector<SingleProc> getByDelay(unsigned long long ns)
+   {
+     std::vector<SingleProc> result;
+     buildProcSummary();
+
+     for (auto p : ProcessSummary.processes)
+       {
+	 auto _p = p.second;
+	 auto& d = _p->delaysDelta;
+	 if ( (_p->delaysSampled) && (d.cpu + d.blkio + d.swapin + d.reclaim >= ns) )
+	   result.push_back(singleProc(_p));
+       }
+
+     return result;
+   }
+
+   /** Gets all process over a PSS threshold (bytes). Needs memoryDetails() */
+   static std::vector<SingleProc> getByPss(unsigned long long threshold)
+   {
+     std::vector<SingleProc> result;
+     buildProcSummary();
+
+     for (auto p : ProcessSummary.processes)
+       {
+	 auto _p = p.second;
+	 if (_p->pss >= threshold)
+	   result.push_back(singleProc(_p));
+       }
+
+     return result;
+   }
+
+   /** Gets all process over a PSS threshold (counting all processes with the same name).
+       Needs memoryDetails() */
+   static std::map<std::string, MultiProc> getByPssCol(unsigned long long threshold)
+   {
+     std::map<std::string, MultiProc> result;
+     buildAdvancedSummary();
+
+     for (auto& p : ProcessSummary.advanced)
+       {
+	 if (p.second.totalpss >= threshold)
+	   result[p.first] = p.second;
+       }
+
+     return result;
+   }
+
+ };
+
+  namespace
+    {
+      /** Parses a stat file up to field Last (proc(5) numbers), no further  */
+      template <unsigned Last>
+      bool parseStatFields(const char* data, Internal::StatFields& f)
+      {
+	f.v[1] = atoi(data);
+	if (Last < 2)
+	  return true;
+
+	const char* open = strchr(data, '(');
+	const char* close = strrchr(data, ')'); /* names can have ')' */
+	if ( (open == NULL) || (close == NULL) || (close[1] == '\0') )
+	  return false;
+	f.name = open+1;
+	f.nameLen = close-open-1;
+	if (Last < 3)
+	  return true;
+
+	f.state = close[2];
+	const char* p = close+3;
+	for (unsigned i=4; i<=Last; ++i)
+	  {
+	    char* end;
+	    f.v[i] = strtoll(p, &end, 10);
+	    if (end == p)
+	      return false;
+	    p = end;
+	  }
+	return true;
+      }
+    };
+
+  namespace Proc
+  {
+    /** A process collector reading just the fields in Fields (FIELD_NAME | FIELD_RSS...),
+	known at compile time: stat files are parsed up to the last field needed (or
+	not read at all if just pids are wanted) and records have just those members.
+	There's no process summary, SingleProc or map involved. e.g:
+	  Umon::Proc::Collector<Umon::Proc::FIELD_NAME> c;
+	  c.scan();
+	  std::cout << c.countProcess("nginx") << std::endl; */
+    template <unsigned Fields>
+    class Collector
+    {
+    public:
+      typedef Record<Fields> record_type;
+
+      Collector(): _sampled(0), _capacity(0), _dropped(0), _truncated(0)
+      {
+      }
+
+      /** Fixed capacity (0 = as many as there are). Memory for max records is
+	  reserved now and scan() won't allocate: processes over it are left
+	  out and counted in dropped(). */
+      void capacity(size_t max)
+      {
+	_capacity = max;
+	_records.reserve(max);
+	_previous.reserve(max);
+      }
+
+      size_t capacity() const
+      {
+	return _capacity;
+      }
+
+      /** Processes left out in the last scan (over capacity)  */
+      unsigned dropped() const
+      {
+	return _dropped;
+      }
+
+      /** Names longer than a record can keep in the last scan (they are cut) */
+      unsigned truncated() const
+      {
+	return _truncated;
+      }
+
+      /** Reads all processes. Records are sorted by pid */
+      const std::vector<record_type>& scan()
+      {
+	_previous.swap(_records);
+	_records.clear();
+	_dropped = _truncated = 0;
+	uint64_t now = statsNow();
+	walkProcesses([this](char* pid) {
+	    readProcess(pid);
+	    return true;
+	  });
+	if (!std::is_sorted(_records.begin(), _records.end(), byPid))
+	  std::sort(_records.begin(), _records.end(), byPid);
+	calculatePcpu(now, std::integral_constant<bool, (Fields & FIELD_PCPU) != 0>());
+	_sampled = now;
+	return _records;
+      }
+
+      const std::vector<record_type>& records() const
+      {
+	return _records;
+      }
+
+      size_t size() const
+      {
+	return _records.size();
+      }
+
+      /** Record of a process (NULL if it wasn't there in the last scan) */
+      const record_type* find(int pid) const
+      {
+	record_type key;
+	key.pid = pid;
+	auto it = std::lower_bound(_records.begin(), _records.end(), key, byPid);
+	return ( (it != _records.end()) && (it->pid == pid) )?&*it:NULL;
+      }
+
+      /** Number of processes with a name  */
+      unsigned countProcess(const char* name) const
+      {
+	static_assert((Fields & FIELD_NAME) != 0, "countProcess() needs FIELD_NAME");
+	unsigned count = 0;
+	for (auto& r : _records)
+	  if (strcmp(r.name, name) == 0)
+	    ++count;
+	return count;
+      }
+
+      /** %CPU of all processes with a name  */
+      double totalPCPU(const char* name) const
+      {
+	static_assert((Fields & (FIELD_NAME | FIELD_PCPU)) == (FIELD_NAME | FIELD_PCPU), "totalPCPU() needs FIELD_NAME and FIELD_PCPU");
+	double total = 0;
+	for (auto& r : _records)
+	  if (strcmp(r.name, name) == 0)
+	    total+=r.pcpu;
+	return total;
+      }
+
+    private:
+      static bool byPid(const record_type& a, const record_type& b)
+      {
+	return a.pid < b.pid;
+      }
+
+      void readProcess(const char* pid)
+      {
+	Internal::StatFields f;
+	char buffer[1024];	/* f.name points here */
+	if ( (_capacity) && (_records.size() >= _capacity) )
+	  {
+	    ++_dropped;
+	    return;
+	  }
+	if (record_type::LAST < 2)
+	  {
+	    /* Just pids: no need to open anything */
+	    f.v[1] = atoi(pid);
+	  }
+	else
+	  {
+	    char filename[PATH_MAX];
+	    snprintf(filename, PATH_MAX, "%s/%s/stat", _procRoot.c_str(), pid);
+	    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	    ++_statsCounters.syscalls;
+	    if (fd == -1)
+	      return;		/* It finished before we could read it */
+	    ssize_t len = readOpenedFile(fd, buffer, sizeof(buffer));
+	    ::close(fd);
+	    ++_statsCounters.syscalls;
+	    if ( (len <= 0) || (!parseStatFields<record_type::LAST>(buffer, f)) )
+	      return;
+	  }
+	if ( ((Fields & FIELD_NAME) != 0) && (f.nameLen >= sizeof(Internal::PartName::name)) )
+	  ++_truncated;
+	if (_records.size() == _records.capacity())
+	  ++_statsCounters.allocations;
+	_records.push_back(record_type());
+	_records.back().load(f);
+      }
+
+      void calculatePcpu(uint64_t, std::false_type)
+      {
+      }
+
+      /** Same pid and start time in the previous scan: both are sorted, so it's a merge */
+      void calculatePcpu(uint64_t now, std::true_type)
+      {
+	double elapsed = (now - _sampled)/1e9 * ticksPerSecond() / 100.0;
+	if ( (!_sampled) || (elapsed <= 0) )
+	  return;
+
+	auto prev = _previous.begin();
+	for (auto& r : _records)
+	  {
+	    while ( (prev != _previous.end()) && (prev->pid < r.pid) )
+	      ++prev;
+	    if ( (prev != _previous.end()) && (prev->pid == r.pid) && (prev->started == r.started) )
+	      r.pcpu = (double)(r.ticks - prev->ticks) / elapsed;
+	  }
+      }
+
+      std::vector<record_type> _records, _previous;
+      uint64_t _sampled;
+      size_t _capacity;
+      unsigned _dropped, _truncated;
+    };
+  };
+
+  /** Fixed capacity collection, for long running small systems where heap fragmentation
+      matters: everything is allocated in init() and refresh() doesn't allocate. */
+  namespace Fixed
+  {
+    /** How much a Monitor can keep  */
+    struct Capacity
+    {
+      unsigned processes;
+      unsigned mounts;
+      unsigned pathLength;	/* mount point, file system and type, '\0' included */
+    };
+
+    /** What didn't fit in the last refresh (all 0 if everything did)  */
+    struct Overflow
+    {
+      unsigned processes;	/* left out, over Capacity::processes */
+      unsigned names;		/* process names cut (Proc::Record keeps 31 characters) */
+      unsigned mounts;		/* left out, over Capacity::mounts */
+      unsigned paths;		/* mount points left out: a path didn't fit in pathLength */
+
+      bool any() const
+      {
+	return (processes) || (names) || (mounts) || (paths);
+      }
+    };
+
+    /** A mount point. Strings are in the Monitor, until next refresh  */
+    struct Mount
+    {
+      const char* fileSystem;
+      const char* mountPoint;
+      const char* type;
+      long blockSize;
+      unsigned long freeBlocks;
+      unsigned long freeBlocksUU;	/* free blocks for unprivileged users */
+      unsigned long totalBlocks;
+      unsigned long fileNodes;
+      unsigned long freeFileNodes;
+      int statfs_errno;
+
+      unsigned long freeSpace() const
+      {
+	return (statfs_errno!=0)?0:(freeBlocksUU * blockSize);
+      }
+
+      unsigned long totalSpace() const
+      {
+	return (statfs_errno!=0)?0:(totalBlocks * blockSize);
+      }
+
+      unsigned long usedSpace() const
+      {
+	return (statfs_errno!=0)?0:((totalBlocks-freeBlocks) * blockSize);
+      }
+
+      double usedRatio() const
+      {
+	return ( (statfs_errno!=0) || (totalBlocks==0))?0:(1-(double)freeBlocksUU/totalBlocks);
+      }
+    };
+
+    /** sysinfo, processes (a Proc::Collector with the fields we want) and mount points
+	with fixed capacity. statfs() is called directly (no threads): a hung network
+	mount point blocks refresh(). */
+    template <unsigned Fields = Proc::FIELD_NAME | Proc::FIELD_STATE | Proc::FIELD_RSS | Proc::FIELD_PCPU>
+    class Monitor
+    {
+    public:
+      Monitor(): _ready(false), _mountCount(0)
+      {
+	memset(&_capacity, 0, sizeof(_capacity));
+	memset(&_sysinfo, 0, sizeof(_sysinfo));
+	memset(&_overflow, 0, sizeof(_overflow));
+      }
+
+      /** Allocates everything. Returns false if capacities make no sense  */
+      bool init(const Capacity& capacity)
+      {
+	if ( (capacity.processes == 0) || (capacity.pathLength < 2) )
+	  return false;
+	_capacity = capacity;
+	_processes.capacity(capacity.processes);
+	_mounts.assign(capacity.mounts, Mount());
+	_paths.assign((size_t)capacity.mounts*3*capacity.pathLength, '\0');
+	/* The three strings of an mtab line, escaped (\040 takes 4 bytes). The rest of
+	   the line (options, as long as overlayfs ones) is skipped */
+	_line.assign(3*4*capacity.pathLength+64, '\0');
+	_ready = true;
+	return true;
+      }
+
+      /** Refreshes everything. Returns false if something didn't fit (see overflow())
+	  or init() wasn't called */
+      bool refresh()
+      {
+	if (!_ready)
+	  return false;
+	::sysinfo(&_sysinfo);
+	++_statsCounters.syscalls;
+	_processes.scan();
+	_overflow.processes = _processes.dropped();
+	_overflow.names = _processes.truncated();
+	refreshMounts();
+	return !_overflow.any();
+      }
+
+      const struct sysinfo& system() const
+      {
+	return _sysinfo;
+      }
+
+      const Proc::Collector<Fields>& processes() const
+      {
+	return _processes;
+      }
+
+      const Mount* mounts() const
+      {
+	return _mounts.data();
+      }
+
+      size_t mountCount() const
+      {
+	return _mountCount;
+      }
+
+      /** Mount point by path (NULL if it isn't there)  */
+      const Mount* mount(const char* mountPoint) const
+      {
+	for (size_t i=0; i<_mountCount; ++i)
+	  if (strcmp(_mounts[i].mountPoint, mountPoint) == 0)
+	    return &_mounts[i];
+	return NULL;
+      }
+
+      const Overflow& overflow() const
+      {
+	return _overflow;
+      }
+
+      const Capacity& capacity() const
+      {
+	return _capacity;
+      }
+
+    private:
+      /** Reads mtab in _line sized chunks (no FILE, getmntent() allocates) */
+      void refreshMounts()
+      {
+	uint64_t start = statsNow();
+	_mountCount = 0;
+	_overflow.mounts = _overflow.paths = 0;
+	int fd = open(_mtabFile.c_str(), O_RDONLY | O_CLOEXEC);
+	++_statsCounters.syscalls;
+	if (fd == -1)
+	  return;
+
+	char* buffer = &_line[0];
+	size_t size = _line.size()-1, len = 0;
+	bool skipping = false;	/* rest of a line too long */
+	ssize_t nread;
+	while ( (nread = read(fd, buffer+len, size-len)) > 0 )
+	  {
+	    ++_statsCounters.syscalls;
+	    _statsCounters.bytesRead+=nread;
+	    len+=nread;
+	    char* line = buffer;
+	    char* eol;
+	    while ( (eol = (char*)memchr(line, '\n', buffer+len-line)) != NULL )
+	      {
+		*eol = '\0';
+		if (!skipping)
+		  mountLine(line);
+		skipping = false;
+		line = eol+1;
+	      }
+	    len = buffer+len-line;
+	    if ( (len == size) && (line == buffer) )
+	      {
+		/* No room for the whole line: we just need its first three fields */
+		buffer[len] = '\0';
+		if (!skipping)
+		  {
+		    if (mtabFieldsIn(buffer, 3))
+		      mountLine(buffer);
+		    else
+		      ++_overflow.paths;
+		  }
+		skipping = true;
+		len = 0;
+	      }
+	    else
+	      memmove(buffer, line, len);
+	  }
+	close(fd);
+	++_statsCounters.syscalls;
+	if ( (len) && (!skipping) )
+	  {
+	    buffer[len] = '\0';
+	    mountLine(buffer);
+	  }
+	++_statsCounters.refreshes;
+	statsRecord(Stats::MOUNTS, statsNow()-start);
+      }
+
+      /** Are there n whole fields (followed by a blank) at the beginning of line?  */
+      static bool mtabFieldsIn(const char* line, unsigned n)
+      {
+	for (unsigned i=0; i<n; ++i)
+	  {
+	    line+=strspn(line, " \t");
+	    line+=strcspn(line, " \t");
+	    if (!*line)
+	      return false;
+	  }
+	return true;
+      }
+
+      /** Copies an mtab field to dest, decoding octal escapes (\040 is a space).
+	  Returns the end of the field in line, or NULL if it didn't fit */
+      static char* mtabField(char* line, char* dest, size_t size)
+      {
+	while (*line == ' ')
+	  ++line;
+	size_t len = 0;
+	for (; (*line) && (*line != ' ') && (*line != '\t'); ++line)
+	  {
+	    if (len+1 >= size)
+	      return NULL;
+	    if ( (*line == '\\') && (line[1] >= '0') && (line[1] <= '3') && (line[2] >= '0') && (line[2] <= '7')
+		 && (line[3] >= '0') && (line[3] <= '7') )
+	      {
+		dest[len++] = (line[1]-'0')*64 + (line[2]-'0')*8 + (line[3]-'0');
+		line+=3;
+	      }
+	    else
+	      dest[len++] = *line;
+	  }
+	dest[len] = '\0';
+	return (len)?line:NULL;
+      }
+
+      void mountLine(char* line)
+      {
+	if (*line == '#')
+	  return;
+	if (_mountCount >= _mounts.size())
+	  {
+	    ++_overflow.mounts;
+	    return;
+	  }
+	size_t pathLength = _capacity.pathLength;
+	char* strings = &_paths[_mountCount*3*pathLength];
+	Mount& m = _mounts[_mountCount];
+	m.fileSystem = strings;
+	m.mountPoint = strings+pathLength;
+	m.type = strings+2*pathLength;
+	if ( ((line = mtabField(line, strings, pathLength)) == NULL) ||
+	     ((line = mtabField(line, strings+pathLength, pathLength)) == NULL) ||
+	     ((line = mtabField(line, strings+2*pathLength, pathLength)) == NULL) )
+	  {
+	    ++_overflow.paths;
+	    return;
+	  }
+
+	struct statfs sfs;
+	uint64_t statfsStart = statsNow();
+	m.statfs_errno = (::statfs(m.mountPoint, &sfs) == 0)?0:errno;
+	++_statsCounters.syscalls;
+	statsRecord(Stats::MOUNTS_STATFS, statsNow()-statfsStart);
+	if (m.statfs_errno == 0)
+	  {
+	    m.blockSize = sfs.f_bsize;
+	    m.freeBlocks = sfs.f_bfree;
+	    m.freeBlocksUU = sfs.f_bavail;
+	    m.totalBlocks = sfs.f_blocks;
+	    m.fileNodes = sfs.f_files;
+	    m.freeFileNodes = sfs.f_ffree;
+	  }
+	else
+	  m.blockSize = m.freeBlocks = m.freeBlocksUU = m.totalBlocks = m.fileNodes = m.freeFileNodes = 0;
+	++_mountCount;
+      }
+
+      bool _ready;
+      Capacity _capacity;
+      struct sysinfo _sysinfo;
+      Proc::Collector<Fields> _processes;
+      std::vector<Mount> _mounts;
+      size_t _mountCount;
+      std::vector<char> _paths;	/* 3 strings of pathLength for each mount */
+      std::vector<char> _line;	/* mtab reading */
+      Overflow _overflow;
+    };
+  };
+
+  /** Private non-blocking collection stuff  */
+  namespace Internal
+  {
+    /** A mount point whose statfs() is running  */
+    struct AsyncStatfs
+    {
+      size_t index;		/* in AsyncState.mounts */
+      uint64_t started,	/* ns, steady clock */
+	deadline;
+      std::shared_ptr<StatfsJob> job;
+    };
+
+    /** Non-blocking collection state (see Async namespace)  */
+    struct AsyncState_t
+    {
+      int epfd = -1,
+	eventfd = -1,		/* step() has something to do */
+	timerfd = -1;		/* periodic refreshes and statfs() timeouts */
+      bool pending[REFRESH_PROC+1];
+      uint64_t interval[REFRESH_PROC+1]; /* ns (0 = just when asked) */
+      uint64_t due[REFRESH_PROC+1];
+      std::vector<std::function<void()> > callbacks[REFRESH_PROC+1];
+      /* mounts refresh in progress */
+      bool mountsStarted;
+      uint64_t mountsStart;
+      Mounts::MountPoints mounts;
+      size_t nextMount;
+      std::vector<AsyncStatfs> inflight;
+      unsigned maxStatfs = 8;
+      std::map<std::string, std::shared_ptr<StatfsJob> > late; /* by mount point, until they finish */
+    };
+  };
+
+  namespace
+    {
+      using Internal::AsyncStatfs;
+      Internal::AsyncState_t& AsyncState = Internal::Shared<Internal::AsyncState_t>::value;
+
+      /** Makes step() be called again (level triggered: until it reads the eventfd)  */
+      void asyncWake()
+      {
+	uint64_t one = 1;
+	if ( (AsyncState.eventfd != -1) && (write(AsyncState.eventfd, &one, sizeof(one)) > 0) )
+	  ++_statsCounters.syscalls;
+      }
+
+      /** A refresh finished: callbacks waiting for it  */
+      void asyncDone(RefreshKind kind)
+      {
+	auto& A = AsyncState;
+	A.pending[kind] = false;
+	std::vector<std::function<void()> > callbacks;
+	callbacks.swap(A.callbacks[kind]);
+	for (auto& f : callbacks)
+	  f();
+      }
+
+      /** Reads mtab: it's in /proc, so it doesn't block. statfs() will be made later */
+      void asyncStartMounts()
+      {
+	auto& A = AsyncState;
+	A.mounts.clear();
+	A.nextMount = 0;
+	A.mountsStart = statsNow();
+	A.mountsStarted = true;
+	FILE *fd = setmntent(_mtabFile.c_str(), "r");
+	++_statsCounters.syscalls;
+	if (fd == NULL)
+	  return;
+
+	struct mntent *ent;
+	while ( (ent = getmntent(fd)) != NULL)
+	  A.mounts.push_back(mountPointEntry(ent));
+	fclose(fd);
+	++_statsCounters.syscalls;
+	statsRecord(Stats::MOUNTS_MTAB, statsNow()-A.mountsStart);
+      }
+
+      /** Collects finished statfs() calls, gives up on late ones and starts new ones.
+	  Returns true when all mount points are done */
+      bool asyncStepMounts(uint64_t now)
+      {
+	auto& A = AsyncState;
+	for (auto it = A.inflight.begin(); it != A.inflight.end(); )
+	  {
+	    StatfsLock lock(*it->job);
+	    if (it->job->done)
+	      {
+		storeStatfs(A.mounts[it->index], *it->job);
+		statsRecord(Stats::MOUNTS_STATFS, now - it->started);
+	      }
+	    else if (now >= it->deadline)
+	      {
+		/* It won't tell us when it finishes. Cancelled as mountsInfo() does, and
+		   if it's still there (a hung NFS server) no other one is started for
+		   that mount point until it finishes: just one stuck thread for each */
+		++_statsCounters.timeouts;
+		it->job->notifyFd = -1;
+#ifndef UMON_NO_THREADS
+		if (pthread_cancel(it->job->thread) == 0)
+		  ++_statsCounters.cancellations;
+#endif
+		A.late[A.mounts[it->index].mountPoint] = it->job;
+	      }
+	    else
+	      {
+		++it;
+		continue;
+	      }
+	    lock.unlock();
+	    it = A.inflight.erase(it);
+	  }
+
+	uint64_t waiting = std::chrono::duration_cast<std::chrono::nanoseconds>(_mountWaiting).count();
+	while ( (A.nextMount < A.mounts.size()) && (A.inflight.size() < A.maxStatfs) )
+	  {
+	    auto late = A.late.find(A.mounts[A.nextMount].mountPoint);
+	    if (late != A.late.end())
+	      {
+		StatfsLock lock(*late->second);
+		bool done = late->second->done;
+		lock.unlock();
+		if (!done)
+		  {
+		    ++_statsCounters.timeouts;	/* not ready, as when it's late */
+		    ++A.nextMount;
+		    continue;
+		  }
+		A.late.erase(late);
+	      }
+	    AsyncStatfs st;
+	    st.index = A.nextMount++;
+	    st.started = now;
+	    st.deadline = now + waiting;
+	    st.job = startStatfs(A.mounts[st.index].mountPoint, A.eventfd);
+	    A.inflight.push_back(st);
+	  }
+
+	return ( (A.inflight.empty()) && (A.nextMount >= A.mounts.size()) );
+      }
+
+      /** Mount points refreshed: same as mountsInfo() does when it finishes  */
+      void asyncFinishMounts()
+      {
+	auto& A = AsyncState;
+	MountSummary.points.swap(A.mounts);
+	A.mounts.clear();
+	MountSummary.tp = std::chrono::steady_clock::now();
+	A.mountsStarted = false;
+	++_statsCounters.refreshes;
+	statsRecord(Stats::MOUNTS, statsNow()-A.mountsStart);
+	notifyRefresh(REFRESH_MOUNTS);
+	asyncDone(REFRESH_MOUNTS);
+      }
+
+      /** Arms the timer for the next periodic refresh or statfs() timeout  */
+      void asyncArmTimer()
+      {
+	auto& A = AsyncState;
+	uint64_t next = 0;
+	for (int k=REFRESH_SYSINFO; k<=REFRESH_PROC; ++k)
+	  if ( (A.interval[k]) && ( (!next) || (A.due[k] < next) ) )
+	    next = A.due[k];
+	for (auto& st : A.inflight)
+	  if ( (!next) || (st.deadline < next) )
+	    next = st.deadline;
+
+	/* steady_clock is CLOCK_MONOTONIC. 0 disarms it */
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = next / 1000000000;
+	its.it_value.tv_nsec = next % 1000000000;
+	timerfd_settime(A.timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	++_statsCounters.syscalls;
+      }
+    };
+
+  /** Non-blocking collection, for single threaded event loops. Umon::Async::fd()
+      is watched in the loop (readable = there's something to do) and then
+      Umon::Async::step() makes a bounded amount of work. Processes are read with
+      Proc::scanStep() and statfs() calls run in their own threads, so a hung
+      network mount doesn't block anything. e.g:
+	Umon::Async::every(Umon::REFRESH_MOUNTS, 10);
+	Umon::Async::refresh(Umon::REFRESH_PROC, []() { ... });
+	// epoll_ctl(loop, EPOLL_CTL_ADD, Umon::Async::fd(), ...EPOLLIN...)
+	// and when it's readable: Umon::Async::step(0.005); */
+  namespace Async
+  {
+    /** File descriptor to watch (EPOLLIN / POLLIN). It's an epoll fd with an
+	eventfd and a timerfd inside. -1 on error */
+    static int fd()
+    {
+      auto& A = AsyncState;
+      if (A.epfd != -1)
+	return A.epfd;
+
+      A.epfd = epoll_create1(EPOLL_CLOEXEC);
+      A.eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      A.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      _statsCounters.syscalls+=3;
+      if ( (A.epfd == -1) || (A.eventfd == -1) || (A.timerfd == -1) )
+	{
+	  if (A.epfd != -1)
+	    ::close(A.epfd);
+	  if (A.eventfd != -1)
+	    ::close(A.eventfd);
+	  if (A.timerfd != -1)
+	    ::close(A.timerfd);
+	  A.epfd = A.eventfd = A.timerfd = -1;
+	  return -1;
+	}
+
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = A.eventfd;
+      epoll_ctl(A.epfd, EPOLL_CTL_ADD, A.eventfd, &ev);
+      ev.data.fd = A.timerfd;
+      epoll_ctl(A.epfd, EPOLL_CTL_ADD, A.timerfd, &ev);
+      _statsCounters.syscalls+=2;
+      for (int k=REFRESH_SYSINFO; k<=REFRESH_PROC; ++k)
+	if (A.pending[k])
+	  asyncWake();
+      asyncArmTimer();
+      return A.epfd;
+    }
+
+    /** Asks for a refresh. done (if any) is called from step() when it finishes.
+	If one is already running, done waits for it. */
+    static void refresh(RefreshKind kind, std::function<void()> done=nullptr)
+    {
+      auto& A = AsyncState;
+      if (done)
+	A.callbacks[kind].push_back(done);
+      if (!A.pending[kind])
+	{
+	  A.pending[kind] = true;
+	  asyncWake();
+	}
+    }
+
+    /** Refreshes something every given seconds (0 = stop). First one right now */
+    static void every(RefreshKind kind, double seconds)
+    {
+      auto& A = AsyncState;
+      A.interval[kind] = (seconds>0)?(uint64_t)(seconds*1e9):0;
+      A.due[kind] = statsNow();
+      if (A.timerfd != -1)
+	asyncArmTimer();
+      if (A.interval[kind])
+	refresh(kind);
+    }
+
+    /** Is a refresh running or asked for? */
+    static bool busy(RefreshKind kind)
+    {
+      return AsyncState.pending[kind];
+    }
+
+    static bool busy()
+    {
+      return ( (busy(REFRESH_SYSINFO)) || (busy(REFRESH_MOUNTS)) || (busy(REFRESH_PROC)) );
+    }
+
+    /** Max statfs() threads running at once getter/setter  */
+    static unsigned maxStatfs()
+    {
+      return AsyncState.maxStatfs;
+    }
+
+    static unsigned maxStatfs(unsigned val)
+    {
+      return (AsyncState.maxStatfs = (val)?val:1);
+    }
+
+    /** Makes some work, budget seconds at most (a bit more if a statfs() or
+	sysinfo() call is slow). Callbacks are called from here. Returns true
+	if there's still work to do (fd() will be readable again). */
+    static bool step(double budget=0.005)
+    {
+      auto& A = AsyncState;
+      uint64_t buffer, now = statsNow();
+      uint64_t deadline = now + (uint64_t)(budget*1e9);
+
+      /* Clear readiness: they're not semaphores, one read is enough */
+      if ( (A.eventfd != -1) && (read(A.eventfd, &buffer, sizeof(buffer)) > 0) )
+	++_statsCounters.syscalls;
+      if ( (A.timerfd != -1) && (read(A.timerfd, &buffer, sizeof(buffer)) > 0) )
+	++_statsCounters.syscalls;
+
+      for (int k=REFRESH_SYSINFO; k<=REFRESH_PROC; ++k)
+	if ( (A.interval[k]) && (A.due[k] <= now) )
+	  {
+	    A.pending[k] = true;
+	    /* Next one from now: a slow refresh doesn't make them pile up */
+	    A.due[k] = now + A.interval[k];
+	  }
+
+      if (A.pending[REFRESH_SYSINFO])
+	{
+	  getSysInfo(true);
+	  asyncDone(REFRESH_SYSINFO);
+	}
+
+      if (A.pending[REFRESH_MOUNTS])
+	{
+	  if (!A.mountsStarted)
+	    asyncStartMounts();
+	  if (asyncStepMounts(statsNow()))
+	    asyncFinishMounts();
+	}
+
+      if (A.pending[REFRESH_PROC])
+	{
+	  now = statsNow();
+	  if ( (now < deadline) && (Proc::scanStep((deadline-now)/1e9)) )
+	    asyncDone(REFRESH_PROC);
+	}
+
+      /* statfs() threads wake us when they finish, and the timer when they're late */
+      bool more = ( (A.pending[REFRESH_SYSINFO]) || (A.pending[REFRESH_PROC]) ||
+		    ( (A.pending[REFRESH_MOUNTS]) && (A.nextMount < A.mounts.size()) &&
+		      (A.inflight.size() < A.maxStatfs) ) );
+      if (more)
+	asyncWake();
+      if (A.timerfd != -1)
+	asyncArmTimer();
+      return busy();
+    }
+
+    /** Closes fd(). Running statfs() threads won't tell us anything else */
+    static void close()
+    {
+      auto& A = AsyncState;
+      for (auto& st : A.inflight)
+	{
+	  StatfsLock lock(*st.job);
+	  st.job->notifyFd = -1;
+	}
+      A.inflight.clear();
+      A.mounts.clear();
+      A.mountsStarted = false;
+      for (int k=REFRESH_SYSINFO; k<=REFRESH_PROC; ++k)
+	{
+	  A.pending[k] = false;
+	  A.interval[k] = 0;
+	  A.callbacks[k].clear();
+	}
+      if (A.epfd != -1)
+	{
+	  ::close(A.epfd);
+	  ::close(A.eventfd);
+	  ::close(A.timerfd);
+	  _statsCounters.syscalls+=3;
+	}
+      A.epfd = A.eventfd = A.timerfd = -1;
+    }
+  };
+
+  /** Private cgroup stuff  */
+  namespace Internal
+  {
+    /** Internal cgroup information, with opened files */
+    struct cgroup_t
+    {
+      Cgroup::CgroupStats st;
+      int
+      cpufd,
+	memfd,
+	memstatfd,
+	iofd;
+      unsigned char updated;
+      std::chrono::steady_clock::time_point sampled;
+    };
+
+    struct CgroupSummary_t
+    {
+      std::string base;		/* real v2 hierarchy root (might be <root>/unified) */
+      std::string baseRoot;		/* cgroupRoot() used to find base */
+      std::map<std::string, cgroup_t*> cgroups;
+      std::map<unsigned, std::pair<unsigned long long, std::string> > procCgroups; /* pid -> (start_time, path) */
+      unsigned char lastUpdate;
+    };
+  };
+
+  namespace
+    {
+      using Internal::cgroup_t;
+      Internal::CgroupSummary_t& CgroupSummary = Internal::Shared<Internal::CgroupSummary_t>::value;
+
+      /** Where is the unified hierarchy? In hybrid systems it's mounted in <root>/unified */
+      std::string cgroupBase()
+      {
+	if ( (CgroupSummary.base.empty()) || (CgroupSummary.baseRoot != _cgroupRoot) )
+	  {
+	    CgroupSummary.baseRoot = _cgroupRoot;
+	    if (access((_cgroupRoot+"/cgroup.controllers").c_str(), F_OK) == 0)
+	      CgroupSummary.base = _cgroupRoot;
+	    else if (access((_cgroupRoot+"/unified/cgroup.controllers").c_str(), F_OK) == 0)
+	      CgroupSummary.base = _cgroupRoot+"/unified";
+	    else
+	      CgroupSummary.base = _cgroupRoot;
+	    _statsCounters.syscalls+=2;
+	  }
+	return CgroupSummary.base;
+      }
+
+      /** Opens cgroup files not opened yet. Returns errno if the cgroup isn't there
+	  (no cpu.stat): other files are just missing when their controller isn't enabled. */
+      int openCgroupFiles(cgroup_t* cg)
+      {
+	static const char* const names[] = { "/cpu.stat", "/memory.current", "/memory.stat", "/io.stat" };
+	int* const fds[] = { &cg->cpufd, &cg->memfd, &cg->memstatfd, &cg->iofd };
+	std::string dir = cgroupBase()+cg->st.path;
+	int error = 0;
+	for (unsigned i=0; i<4; ++i)
+	  if (*fds[i] == -1)
+	    {
+	      *fds[i] = open((dir+names[i]).c_str(), O_RDONLY | O_CLOEXEC);
+	      ++_statsCounters.syscalls;
+	      if ( (*fds[i] == -1) && (i == 0) )
+		error = errno;
+	    }
+	return error;
+      }
+
+      void closeCgroupFiles(cgroup_t* cg)
+      {
+	int* const fds[] = { &cg->cpufd, &cg->memfd, &cg->memstatfd, &cg->iofd };
+	for (int* fd : fds)
+	  if (*fd != -1)
+	    {
+	      close(*fd);
+	      ++_statsCounters.syscalls;
+	      *fd = -1;
+	    }
+      }
+
+      /** Opens cgroup files. They are kept opened while they can be read, and opened
+	  again if the cgroup is removed and created again. */
+      cgroup_t* openCgroup(std::string path)
+      {
+	cgroup_t* cg = new cgroup_t();
+	_statsCounters.allocations+=2;
+	cg->st.path = path;
+	cg->cpufd = cg->memfd = cg->memstatfd = cg->iofd = -1;
+	cg->st.error = openCgroupFiles(cg);
+	return cg;
+      }
+
+      void closeCgroup(cgroup_t* cg)
+      {
+	closeCgroupFiles(cg);
+	delete cg;
+      }
+
+      /** Reads opened cgroup files into st. errno of the first failed read, 0 if
+	  they were read */
+      int readCgroupFiles(cgroup_t* cg, char* buffer, size_t bufferSize)
+      {
+	static const char* const cpuKeys[] = { "usage_usec", "user_usec", "system_usec",
+					       "nr_periods", "nr_throttled", "throttled_usec" };
+	static const char* const memKeys[] = { "anon", "file", "kernel_stack", "slab",
+					       "sock", "shmem", "pgfault", "pgmajfault" };
+	Cgroup::CgroupStats& st = cg->st;
+	int error = 0;
+	/* An empty file (io.stat with no I/O) is fine, a failed read isn't */
+	auto read = [&error, buffer, bufferSize](int fd) {
+	  if (fd == -1)
+	    return false;
+	  errno = 0;
+	  if ( (readOpenedFile(fd, buffer, bufferSize) == 0) && (errno) )
+	    {
+	      if (!error)
+		error = errno;
+	      return false;
+	    }
+	  return true;
+	};
+
+	if (read(cg->cpufd))
+	  {
+	    uint64_t* const cpuValues[] = { &st.usageUsec, &st.userUsec, &st.systemUsec,
+					    &st.nrPeriods, &st.nrThrottled, &st.throttledUsec };
+	    parseKeyValues(buffer, cpuKeys, cpuValues, 6);
+	  }
+	if (read(cg->memfd))
+	  st.memoryCurrent = strtoull(buffer, NULL, 10);
+	if (read(cg->memstatfd))
+	  {
+	    uint64_t* const memValues[] = { &st.anon, &st.file, &st.kernelStack, &st.slab,
+					    &st.sock, &st.shmem, &st.pgfault, &st.pgmajfault };
+	    parseKeyValues(buffer, memKeys, memValues, 8);
+	  }
+	if (read(cg->iofd))
+	  {
+	    /* 8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=5 dios=6 (one line per device) */
+	    uint64_t* const ioValues[] = { &st.rbytes, &st.wbytes, &st.rios, &st.wios, &st.dbytes, &st.dios };
+	    static const char* const ioKeys[] = { "rbytes=", "wbytes=", "rios=", "wios=", "dbytes=", "dios=" };
+	    for (unsigned i=0; i<6; ++i)
+	      *ioValues[i] = 0;
+	    for (char* tok = strtok(buffer, " \n"); tok!=NULL; tok = strtok(NULL, " \n"))
+	      for (unsigned i=0; i<6; ++i)
+		if (strncmp(tok, ioKeys[i], strlen(ioKeys[i])) == 0)
+		  {
+		    *ioValues[i] += strtoull(tok+strlen(ioKeys[i]), NULL, 10);
+		    break;
+		  }
+	  }
+	return error;
+      }
+
+      /** Reads cgroup files and calculates rates from the last time */
+      void refreshCgroup(cgroup_t* cg)
+      {
+	char buffer[8192];
+	uint64_t start = statsNow();
+	auto now = std::chrono::steady_clock::now();
+	Cgroup::CgroupStats old = cg->st;
+	Cgroup::CgroupStats& st = cg->st;
+
+	/* Files missing before are looked for again (the cgroup was created later, a
+	   controller was enabled). A removed cgroup gives ENODEV on its old files: if
+	   it was created again they are opened again. */
+	int error = openCgroupFiles(cg);
+	if (!error)
+	  {
+	    error = readCgroupFiles(cg, buffer, sizeof(buffer));
+	    if (error)
+	      {
+		closeCgroupFiles(cg);
+		error = openCgroupFiles(cg);
+		if (!error)
+		  error = readCgroupFiles(cg, buffer, sizeof(buffer));
+	      }
+	  }
+	st.error = error;
+
+	double elapsed = std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(now-cg->sampled).count();
+	if ( (cg->sampled.time_since_epoch().count()) && (elapsed>0) )
+	  {
+	    /* Counters going backwards (a cgroup created again, a failed read) give 0 */
+	    auto rate = [elapsed](uint64_t current, uint64_t previous) {
+	      return (current >= previous)?(current - previous) / elapsed:0;
+	    };
+	    st.pcpu = rate(st.usageUsec, old.usageUsec) / 1e4;
+	    st.readRate = rate(st.rbytes, old.rbytes);
+	    st.writeRate = rate(st.wbytes, old.wbytes);
+	    st.readIops = rate(st.rios, old.rios);
+	    st.writeIops = rate(st.wios, old.wios);
+	  }
+	cg->sampled = now;
+	statsRecord(Stats::CGROUP, statsNow()-start);
+      }
+
+      /** Gets a cgroup, opening it if needed and refreshing it if it's too old */
+      cgroup_t* getCgroup(std::string path, bool reload)
+      {
+	auto it = CgroupSummary.cgroups.find(path);
+	cgroup_t* cg;
+	if (it == CgroupSummary.cgroups.end())
+	  {
+	    cg = openCgroup(path);
+	    CgroupSummary.cgroups[path] = cg;
+	    reload = true;
+	  }
+	else
+	  cg = it->second;
+
+	if ( (reload) || (cg->sampled+_valueDuration < std::chrono::steady_clock::now()) )
+	  refreshCgroup(cg);
+	cg->updated = CgroupSummary.lastUpdate;
+
+	return cg;
+      }
+
+      /** Walks a cgroup directory and all its children */
+      void walkCgroups(std::string path, std::function<void(std::string)> f)
+      {
+	f(path);
+	DIR* dir = opendir((cgroupBase()+path).c_str());
+	_statsCounters.syscalls+=3;	/* open, getdents, close */
+	if (dir == NULL)
+	  return;
+
+	direct *ent;
+	while ((ent = readdir(dir)))
+	  {
+	    if ( (ent->d_type == DT_DIR) && (ent->d_name[0] != '.') )
+	      walkCgroups(((path=="/")?"":path)+"/"+ent->d_name, f);
+	  }
+	closedir(dir);
+      }
+    };
+
+  /** Watch just some processes. Refreshing them doesn't walk /proc, so it
+      depends on the number of watched processes, not on all system processes. */
+  namespace Watch
+  {
+    /** A watch list. Processes are watched through their /proc/<pid>/stat file,
+	kept opened, and a pidfd (Linux >= 5.3) to know when they finish.
+	e.g:
+	  Umon::Watch::List w;
+	  w.addName("nginx");
+	  w.add(1234);
+	  w.refresh();
+	  std::cout << w.totalPCPU("nginx") << std::endl; */
+    class List
+    {
+    public:
+      List()
+      {
+      }
+
+      ~List()
+      {
+	clear();
+      }
+
+      List(const List&) = delete;
+      List& operator=(const List&) = delete;
+
+      /** Watches a process. Returns false if it can't be read  */
+      bool add(unsigned pid)
+      {
+	char filename[PATH_MAX];
+	char buffer[1024];
+	if (_procs.find(pid) != _procs.end())
+	  return true;
+
+	watched_t w;
+	memset(&w.P, 0, sizeof(w.P));
+	w.pidfd = -1;
+#ifdef SYS_pidfd_open
+	/* First the pidfd, so the pid can't be reused between it and the stat file */
+	if (_procRoot == "/proc")
+	  {
+	    w.pidfd = syscall(SYS_pidfd_open, pid, 0);
+	    ++_statsCounters.syscalls;
+	  }
+#endif
+	snprintf(filename, PATH_MAX, "%s/%u/stat", _procRoot.c_str(), pid);
+	w.statfd = open(filename, O_RDONLY | O_CLOEXEC);
+	++_statsCounters.syscalls;
+	if ( (w.statfd == -1) || (readOpenedFile(w.statfd, buffer, sizeof(buffer)) <= 0) ||
+	     (!parseProcStat(buffer, &w.P)) )
+	  {
+	    closeFds(w);
+	    return false;
+	  }
+	struct stat st;
+	w.P.uid = (fstat(w.statfd, &st) == 0)?(int)st.st_uid:-1; /* owned by the process owner */
+	++_statsCounters.syscalls;
+	w.P.newproc = 1;
+	processCpu(&w.P, 0);
+	w.sampled = std::chrono::steady_clock::now();
+	_procs[pid] = w;
+	_statsCounters.allocations+=1;
+	return true;
+      }
+
+      /** Watches all processes with a name. Names are resolved now (walking /proc
+	  once), new processes with this name won't be watched until we call it
+	  again. Returns the number of processes watched with this name. */
+      unsigned addName(std::string name)
+      {
+	unsigned count = 0;
+	walkProcesses([&](char* procId) {
+	    char filename[PATH_MAX];
+	    proc_t P = proc_t();
+	    snprintf(filename, PATH_MAX, "%s/%s/stat", _procRoot.c_str(), procId);
+	    std::string data = extractFile(filename);
+	    if ( (!data.empty()) && (parseProcStat(data.c_str(), &P)) && (name == P.name) && (add(P.pid)) )
+	      ++count;
+	    return true;
+	  });
+	return count;
+      }
+
+      /** Stops watching a process  */
+      bool remove(unsigned pid)
+      {
+	auto it = _procs.find(pid);
+	if (it == _procs.end())
+	  return false;
+
+	closeFds(it->second);
+	_procs.erase(it);
+	return true;
+      }
+
+      /** Stops watching everything  */
+      void clear()
+      {
+	for (auto& w : _procs)
+	  closeFds(w.second);
+	_procs.clear();
+      }
+
+      /** Number of processes watched  */
+      size_t size()
+      {
+	return _procs.size();
+      }
+
+      /** Called when a watched process finishes (with its last information). It
+	  won't be watched anymore. */
+      void onExit(std::function<void(const Proc::SingleProc&)> callback)
+      {
+	_onExit = callback;
+      }
+
+      /** Refreshes watched processes information (if valueDuration() passed, or
+	  reload is true) and detects finished processes. Returns processes alive. */
+      unsigned refresh(bool reload=false)
+      {
+	auto now = std::chrono::steady_clock::now();
+	if ( (!reload) && (_refresh_tp+_valueDuration >= now) )
+	  return _procs.size();
+
+	char buffer[1024];
+	std::vector<Proc::SingleProc> finished;
+	++_statsCounters.refreshes;
+	checkExits(0, finished);
+	for (auto it = _procs.begin(); it!=_procs.end(); )
+	  {
+	    watched_t& w = it->second;
+	    /* Reading stat of a finished process fails with ESRCH */
+	    if ( (readOpenedFile(w.statfd, buffer, sizeof(buffer)) <= 0) || (!parseProcStat(buffer, &w.P)) )
+	      {
+		it = exited(it, finished);
+		continue;
+	      }
+	    now = std::chrono::steady_clock::now();
+	    w.P.newproc = 0;
+	    processCpu(&w.P, std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(now-w.sampled).count());
+	    w.sampled = now;
+	    ++it;
+	  }
+	_refresh_tp = now;
+	notifyExits(finished);
+	return _procs.size();
+      }
+
+      /** Waits until a watched process finishes. timeout in milliseconds (-1 forever).
+	  Returns its pid, or 0 on timeout or if pidfds are not available. */
+      unsigned waitExit(int timeoutMs)
+      {
+	std::vector<Proc::SingleProc> finished;
+	unsigned pid = checkExits(timeoutMs, finished);
+	notifyExits(finished);
+	return pid;
+      }
+
+      /** Gets a watched process. If it's not watched, error will be ESRCH  */
+      Proc::SingleProc get(unsigned pid)
+      {
+	auto it = _procs.find(pid);
+	if (it == _procs.end())
+	  {
+	    Proc::SingleProc sp = Proc::SingleProc();
+	    sp.pid = pid;
+	    sp.error = ESRCH;
+	    return sp;
+	  }
+	return singleProc(&it->second.P);
+      }
+
+      /** Gets all watched processes  */
+      std::map<unsigned, Proc::SingleProc> getAll()
+      {
+	std::map<unsigned, Proc::SingleProc> result;
+	for (auto& w : _procs)
+	  result[w.first] = singleProc(&w.second.P);
+	return result;
+      }
+
+      /** Gets all watched processes with a name  */
+      Proc::MultiProc getByName(std::string name)
+      {
+	Proc::MultiProc mp = Proc::MultiProc();
+	mp.name = name;
+	for (auto& w : _procs)
+	  {
+	    proc_t& P = w.second.P;
+	    if (name != P.name)
+	      continue;
+	    mp.pcpu+=P.pcpu;
+	    mp.totalpcpu+=P.totalpcpu;
+	    mp.totalvsize+=P.vsize;
+	    mp.totalrss+=P.rss;
+	    mp.totalpss+=P.pss;
+	    mp.totaluss+=P.uss;
+	    mp.totalswap+=P.swap;
+	    ++mp.count;
+	    mp.processes[w.first] = singleProc(&P);
+	  }
+	return mp;
+      }
+
+      /** count watched processes with given name  */
+      unsigned countProcess(std::string name)
+      {
+	return getByName(name).count;
+      }
+
+      /** total %CPU of watched processes with given name  */
+      double totalPCPU(std::string name, bool allTime=false)
+      {
+	auto mp = getByName(name);
+	return (allTime)?mp.totalpcpu:mp.pcpu;
+      }
+
+    private:
+      struct watched_t
+      {
+	proc_t P;
+	int statfd;
+	int pidfd;
+	std::chrono::steady_clock::time_point sampled;
+      };
+
+      void closeFds(watched_t& w)
+      {
+	if (w.statfd != -1)
+	  close(w.statfd);
+	if (w.pidfd != -1)
+	  close(w.pidfd);
+	_statsCounters.syscalls+=2;
+      }
+
+      /** Stops watching a finished process. Its last information goes to finished,
+	  callbacks are called later (see notifyExits()) */
+      std::map<unsigned, watched_t>::iterator exited(std::map<unsigned, watched_t>::iterator it,
+						     std::vector<Proc::SingleProc>& finished)
+      {
+	finished.push_back(singleProc(&it->second.P));
+	closeFds(it->second);
+	return _procs.erase(it);
+      }
+
+      /** Calls onExit() callback for finished processes. Not while iterating
+	  _procs: the callback can remove() or clear() */
+      void notifyExits(const std::vector<Proc::SingleProc>& finished)
+      {
+	if (_onExit)
+	  for (auto& sp : finished)
+	    _onExit(sp);
+      }
+
+      /** Polls all pidfds at once. A pidfd is readable when the process finishes.
+	  Returns the pid of the first finished process found (or 0) */
+      unsigned checkExits(int timeoutMs, std::vector<Proc::SingleProc>& finished)
+      {
+	std::vector<struct pollfd> pfds;
+	std::vector<unsigned> pids;
+	for (auto& w : _procs)
+	  if (w.second.pidfd != -1)
+	    {
+	      pfds.push_back({w.second.pidfd, POLLIN, 0});
+	      pids.push_back(w.first);
+	    }
+	if (pfds.empty())
+	  return 0;
+
+	++_statsCounters.syscalls;
+	if (poll(pfds.data(), pfds.size(), timeoutMs) <= 0)
+	  return 0;
+
+	unsigned first = 0;
+	for (unsigned i=0; i<pfds.size(); ++i)
+	  if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+	    {
+	      auto it = _procs.find(pids[i]);
+	      if (it != _procs.end())
+		exited(it, finished);
+	      if (!first)
+		first = pids[i];
+	    }
+	return first;
+      }
+
+      std::map<unsigned, watched_t> _procs;
+      std::chrono::steady_clock::time_point _refresh_tp;
+      std::function<void(const Proc::SingleProc&)> _onExit;
+    };
+  };
+
+  /** cgroup public functions  */
+  namespace Cgroup
+  {
+    /** Gets a cgroup stats (path relative to cgroupRoot())  */
+    static CgroupStats get(std::string path, bool reload=false)
+    {
+      return getCgroup(path, reload)->st;
+    }
+
+    /** Gets a cgroup and all its descendants. Files will be kept opened while
+	cgroups exist, so next refreshes will just read them. */
+    static Cgroups subtree(std::string path="/", bool reload=false)
+    {
+      Cgroups result;
+      ++CgroupSummary.lastUpdate;
+      ++_statsCounters.refreshes;
+      walkCgroups(path, [&](std::string cgpath) {
+	  result[cgpath] = getCgroup(cgpath, reload)->st;
+	});
+
+      /* Close cgroups under path not seen anymore (/a/b is under /a, /ab isn't) */
+      for (auto i=CgroupSummary.cgroups.begin(); i!=CgroupSummary.cgroups.end(); )
+	{
+	  bool under = ( (path=="/") ||
+			 ( (i->first.compare(0, path.size(), path)==0) &&
+			   ( (i->first.size() == path.size()) || (i->first[path.size()] == '/') ||
+			     (path.back() == '/') ) ) );
+	  if ( (i->second->updated != CgroupSummary.lastUpdate) && (under) )
+	    {
+	      closeCgroup(i->second);
+	      i = CgroupSummary.cgroups.erase(i);
+	    }
+	  else
+	    ++i;
+	}
+      return result;
+    }
+
+    /** cgroup path of a process (from /proc/<pid>/cgroup). It's cached until
+	the pid is reused by another process. */
+    static std::string ofProcess(unsigned pid)
+    {
+      unsigned long long start_time = 0;
+      auto proc = ProcessSummary.processes.find(pid);
+      if ( (proc != ProcessSummary.processes.end()) && (proc->second != NULL) )
+	start_time = proc->second->start_time;
+
+      auto it = CgroupSummary.procCgroups.find(pid);
+      if ( (it != CgroupSummary.procCgroups.end()) && (start_time) && (it->second.first == start_time) )
+	return it->second.second;
+
+      std::string path = readProcessCgroup(pid);
+      if (start_time)
+	CgroupSummary.procCgroups[pid] = std::make_pair(start_time, path);
+      else
+	CgroupSummary.procCgroups.erase(pid);
+
+      return path;
+    }
+
+    /** Gets stats of the cgroup a process belongs to */
+    static CgroupStats ofProcessStats(unsigned pid, bool reload=false)
+    {
+      std::string path = ofProcess(pid);
+      if (path.empty())
+	{
+	  CgroupStats st = CgroupStats();
+	  st.error = ENOENT;
+	  return st;
+	}
+      return get(path, reload);
+    }
+
+    /** Forget processes cgroups of finished processes. Call it from time to time
+	if you use ofProcess() with lots of processes. */
+    static void cleanupProcesses()
+    {
+      for (auto i=CgroupSummary.procCgroups.begin(); i!=CgroupSummary.procCgroups.end(); )
+	{
+	  if (ProcessSummary.processes.find(i->first) == ProcessSummary.processes.end())
+	    i = CgroupSummary.procCgroups.erase(i);
+	  else
+	    ++i;
+	}
+    }
+
+    /** Pressure Stall Information of a cgroup  */
+    static Pressure pressure(std::string path, PressureResource res)
+    {
+      std::string data = extractFile((cgroupBase()+path+"/"+pressureFileName(res)+".pressure").c_str());
+      if (data.empty())
+	return Pressure({{0,0,0,0}, {0,0,0,0}, ENOENT});
+      return parsePressure(data.c_str());
+    }
+  };
+
+  inline bool PressureTrigger::openCgroup(std::string path, PressureResource res, bool full, unsigned long stallUs, unsigned long windowUs)
+  {
+    return openFile(cgroupBase()+path+"/"+pressureFileName(res)+".pressure", full, stallUs, windowUs);
+  }
+
+  /** TCP and UDP sockets straight from the kernel (netlink sock_diag), instead of
+      parsing /proc/net/tcp* files  */
+  namespace Sockets
+  {
+    enum Protocol
+      {
+	TCP = IPPROTO_TCP,
+	UDP = IPPROTO_UDP
+      };
+
+    /** Socket states, numbered as the kernel does. UDP sockets are
+	ESTABLISHED when connected and CLOSE when not. */
+    enum State
+      {
+	STATE_ESTABLISHED = 1,
+	STATE_SYN_SENT,
+	STATE_SYN_RECV,
+	STATE_FIN_WAIT1,
+	STATE_FIN_WAIT2,
+	STATE_TIME_WAIT,
+	STATE_CLOSE,
+	STATE_CLOSE_WAIT,
+	STATE_LAST_ACK,
+	STATE_LISTEN,
+	STATE_CLOSING,
+	STATE_NEW_SYN_RECV,
+	STATE_COUNT
+      };
+
+    /** State masks (1<<State ORed). The kernel only sends us sockets in those states */
+    enum : unsigned
+      {
+	STATES_ALL = (1u<<STATE_COUNT)-1,
+	STATES_LISTEN = 1u<<STATE_LISTEN,
+	/* same as ss "connected": all but LISTEN, CLOSE, TIME_WAIT and SYN_RECV */
+	STATES_CONNECTED = STATES_ALL & ~((1u<<STATE_LISTEN) | (1u<<STATE_CLOSE) | (1u<<STATE_TIME_WAIT) |
+					  (1u<<STATE_SYN_RECV) | (1u<<STATE_NEW_SYN_RECV))
+      };
+
+    /** A socket, as the kernel sends it. Addresses are in network byte order
+	(just local[0] and remote[0] for IPv4) */
+    struct Socket
+    {
+      uint8_t family;		/* AF_INET or AF_INET6 */
+      uint8_t state;		/* State */
+      uint16_t localPort;
+      uint16_t remotePort;
+      uint32_t local[4];
+      uint32_t remote[4];
+      uint32_t inode;		/* 0 if it has no owner (TIME_WAIT) */
+      uint32_t uid;
+      uint32_t rqueue;		/* LISTEN: accept queue length. Others: bytes not read yet */
+      uint32_t wqueue;		/* LISTEN: accept queue limit. Others: bytes not sent or acked */
+    };
+
+    /** Sockets counted by state, local port and process */
+    struct Counts
+    {
+      unsigned total;
+      unsigned states[STATE_COUNT];
+      std::map<unsigned, unsigned> ports;	/* local port: sockets */
+      std::map<unsigned, unsigned> processes; /* pid: sockets (when asked for) */
+      int error;		/* errno, 0 if it went well */
+    };
+  };
+
+  namespace Internal
+  {
+    /** sock_diag netlink socket (internal use). Kept opened */
+    struct SocketSummary_t
+    {
+      bool opened;
+      int fd;
+      uint32_t seq;
+      std::vector<unsigned> ports;	/* sockets by local port, while counting */
+      std::unordered_set<uint32_t> inodes; /* socket inodes, to look for their processes */
+    };
+  };
+
+  namespace
+    {
+      Internal::SocketSummary_t& SocketSummary = Internal::Shared<Internal::SocketSummary_t>::value;
+
+      int sockDiagOpen()
+      {
+	auto& S = SocketSummary;
+	if (S.opened)
+	  return 0;
+	S.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	++_statsCounters.syscalls;
+	if (S.fd == -1)
+	  return errno;
+	S.opened = true;
+	return 0;
+      }
+
+      /** Asks the kernel for sockets of a family and protocol in some states and calls
+	  f(inet_diag_msg) with each one as messages arrive, nothing is stored. When f
+	  returns false it's not called again, but the rest of the dump is read.
+	  Returns errno (0 if ok) */
+      template <typename F>
+      int sockDiagDump(uint8_t family, uint8_t protocol, unsigned states, F f)
+      {
+	auto& S = SocketSummary;
+	int err = sockDiagOpen();
+	if (err)
+	  return err;
+
+	struct
+	{
+	  nlmsghdr nlh;
+	  inet_diag_req_v2 req;
+	} request;
+	memset(&request, 0, sizeof(request));
+	request.nlh.nlmsg_len = sizeof(request);
+	request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	request.nlh.nlmsg_seq = ++S.seq;
+	request.req.sdiag_family = family;
+	request.req.sdiag_protocol = protocol;
+	request.req.idiag_states = states;
+
+	sockaddr_nl kernel;
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	++_statsCounters.syscalls;
+	if (sendto(S.fd, &request, sizeof(request), 0, (sockaddr*)&kernel, sizeof(kernel)) == -1)
+	  return errno;
+
+	alignas(nlmsghdr) char buffer[32768];
+	bool wanted = true;
+	while (true)
+	  {
+	    ssize_t nread = recv(S.fd, buffer, sizeof(buffer), 0);
+	    ++_statsCounters.syscalls;
+	    if (nread == -1)
+	      {
+		if (errno == EINTR)
+		  continue;
+		return errno;
+	      }
+	    _statsCounters.bytesRead+=nread;
+	    int len = nread;
+	    for (nlmsghdr* h = (nlmsghdr*)buffer; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+	      {
+		/* Something left from a dump we didn't finish */
+		if (h->nlmsg_seq != S.seq)
+		  continue;
+		if (h->nlmsg_type == NLMSG_DONE)
+		  return 0;
+		if (h->nlmsg_type == NLMSG_ERROR)
+		  {
+		    nlmsgerr* e = (nlmsgerr*)NLMSG_DATA(h);
+		    return ( (h->nlmsg_len >= NLMSG_LENGTH(sizeof(nlmsgerr))) && (e->error) )?-e->error:EIO;
+		  }
+		if ( (wanted) && (h->nlmsg_type == SOCK_DIAG_BY_FAMILY) )
+		  wanted = f(*(const inet_diag_msg*)NLMSG_DATA(h));
+	      }
+	  }
+      }
+
+      /** IPv4 and IPv6 sockets of a protocol. There may be no IPv6 at all */
+      template <typename F>
+      int sockDiagEach(uint8_t protocol, unsigned states, F f)
+      {
+	bool more = true;
+	auto g = [&more, &f](const inet_diag_msg& m) { return more = f(m); };
+	int err = sockDiagDump(AF_INET, protocol, states, g);
+	if ( (!err) && (more) )
+	  {
+	    err = sockDiagDump(AF_INET6, protocol, states, g);
+	    if (err == ENOENT)
+	      err = 0;
+	  }
+	return err;
+      }
+
+      void socketFromDiag(const inet_diag_msg& m, Sockets::Socket& s)
+      {
+	s.family = m.idiag_family;
+	s.state = m.idiag_state;
+	s.localPort = ntohs(m.id.idiag_sport);
+	s.remotePort = ntohs(m.id.idiag_dport);
+	memcpy(s.local, m.id.idiag_src, sizeof(s.local));
+	memcpy(s.remote, m.id.idiag_dst, sizeof(s.remote));
+	s.inode = m.idiag_inode;
+	s.uid = m.idiag_uid;
+	s.rqueue = m.idiag_rqueue;
+	s.wqueue = m.idiag_wqueue;
+      }
+
+      /** Counts sockets in SocketSummary.inodes each process has opened, reading
+	  /proc/<pid>/fd links of processes in the summary (the kernel doesn't tell
+	  us who owns a socket). Processes we can't look into are skipped. */
+      void socketOwners(std::map<unsigned, unsigned>& processes)
+      {
+	auto& S = SocketSummary;
+	if (ProcessSummary.processes.empty())
+	  Proc::buildProcSummary();
+
+	char buffer[32768];
+	char path[PATH_MAX];
+	char link[64];
+	for (auto& p : ProcessSummary.processes)
+	  {
+	    snprintf(path, sizeof(path), "%s/%u/fd", _procRoot.c_str(), p.first);
+	    int dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	    ++_statsCounters.syscalls;
+	    if (dir == -1)
+	      continue;
+
+	    unsigned count = 0;
+	    long nread;
+	    while ( (nread = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0 )
+	      {
+		++_statsCounters.syscalls;
+		for (long pos = 0; pos<nread; )
+		  {
+		    linux_dirent64 *ent = (linux_dirent64*)(buffer+pos);
+		    pos+=ent->d_reclen;
+		    if (*ent->d_name == '.')
+		      continue;
+		    ssize_t len = readlinkat(dir, ent->d_name, link, sizeof(link)-1);
+		    ++_statsCounters.syscalls;
+		    if ( (len > 9) && (memcmp(link, "socket:[", 8) == 0) )
+		      {
+			link[len] = '\0';
+			if (S.inodes.count(strtoul(link+8, NULL, 10)))
+			  ++count;
+		      }
+		  }
+	      }
+	    close(dir);
+	    _statsCounters.syscalls+=2;	/* last getdents and close */
+	    if (count)
+	      processes[p.first] = count;
+	  }
+      }
+
+      int countSockets(uint8_t protocol, unsigned states, bool byProcess, Sockets::Counts& c)
+      {
+	auto& S = SocketSummary;
+	uint64_t start = statsNow();
+	if (S.ports.empty())
+	  S.ports.resize(65536);
+	S.inodes.clear();
+
+	c.total = 0;
+	memset(c.states, 0, sizeof(c.states));
+	c.ports.clear();
+	c.processes.clear();
+	c.error = sockDiagEach(protocol, states, [&S, &c, byProcess](const inet_diag_msg& m) {
+	    ++c.total;
+	    if (m.idiag_state < Sockets::STATE_COUNT)
+	      ++c.states[m.idiag_state];
+	    ++S.ports[ntohs(m.id.idiag_sport)];
+	    if ( (byProcess) && (m.idiag_inode) )
+	      S.inodes.insert(m.idiag_inode);
+	    return true;
+	  });
+
+	/* ports come sorted, so they go at the end of the map */
+	for (unsigned port = 0; port<S.ports.size(); ++port)
+	  if (S.ports[port])
+	    {
+	      c.ports.emplace_hint(c.ports.end(), port, S.ports[port]);
+	      S.ports[port] = 0;
+	    }
+	if ( (byProcess) && (!S.inodes.empty()) )
+	  socketOwners(c.processes);
+	statsRecord(Stats::SOCKETS, statsNow()-start);
+	return c.error;
+      }
+    };
+
+  namespace Sockets
+  {
+    /** Calls f with each socket of a protocol (IPv4 and IPv6) in some states (mask of
+	1<<State) as the kernel sends them, until it returns false. Returns errno, 0 if ok */
+    static int each(Protocol protocol, unsigned states, std::function<bool(const Socket&)> f)
+    {
+      Socket s;
+      return sockDiagEach(protocol, states, [&s, &f](const inet_diag_msg& m) {
+	  socketFromDiag(m, s);
+	  return f(s);
+	});
+    }
+
+    /** Sockets of a protocol in some states counted by state and local port. With
+	byProcess, by process too (it reads /proc/<pid>/fd of every process, so it's slower) */
+    static Counts count(Protocol protocol=TCP, unsigned states=STATES_ALL, bool byProcess=false)
+    {
+      Counts c;
+      countSockets(protocol, states, byProcess, c);
+      return c;
+    }
+
+    /** Sockets in a state (-1 if they can't be asked for) */
+    static long countByState(State state, Protocol protocol=TCP)
+    {
+      long result = 0;
+      int err = sockDiagEach(protocol, 1u<<state, [&result](const inet_diag_msg&) { ++result; return true; });
+      return (err)?-1:result;
+    }
+
+    /** Sockets listening in a port (TCP), or bound to it (UDP) */
+    static bool listening(unsigned port, Protocol protocol=TCP)
+    {
+      bool found = false;
+      sockDiagEach(protocol, (protocol == TCP)?STATES_LISTEN:(1u<<STATE_CLOSE), [&found, port](const inet_diag_msg& m) {
+	  found = (ntohs(m.id.idiag_sport) == port);
+	  return !found;
+	});
+      return found;
+    }
+
+    /** State name, as ss shows it */
+    static const char* stateName(unsigned state)
+    {
+      static const char* names[STATE_COUNT] = { "UNKNOWN", "ESTAB", "SYN-SENT", "SYN-RECV", "FIN-WAIT-1", "FIN-WAIT-2",
+						"TIME-WAIT", "UNCONN", "CLOSE-WAIT", "LAST-ACK", "LISTEN", "CLOSING",
+						"SYN-RECV" };
+      return (state<STATE_COUNT)?names[state]:"UNKNOWN";
+    }
+  };
+
+  /** Delay accounting of processes and threads from taskstats (generic netlink):
+      how long they waited for a CPU, block I/O, swap in and memory reclaim. */
+  namespace Taskstats
+  {
+    /** Delays of a pid  */
+    struct TaskDelays
+    {
+      int pid;
+      Proc::Delays delays;
+      int error;		/* errno: ESRCH if there's no such process, EPERM if we can't ask */
+    };
+
+    /** Delays of some processes (thread groups: all their threads) or single threads */
+    static std::vector<TaskDelays> get(const std::vector<int>& pids, bool threadGroup=true)
+    {
+      std::vector<TaskDelays> result(pids.size());
+      for (size_t i=0; i<pids.size(); ++i)
+	result[i] = TaskDelays({pids[i], Proc::Delays(), ENODATA});
+      int err = taskstatsQuery(pids.data(), pids.size(), threadGroup, [&result](size_t i, const Proc::Delays& delays, int error) {
+	  result[i].delays = delays;
+	  result[i].error = error;
+	});
+      if (err)
+	for (auto& r : result)
+	  r.error = err;
+      return result;
+    }
+
+    /** Delays of a process (or a single thread)  */
+    static TaskDelays get(int pid, bool threadGroup=true)
+    {
+      return get(std::vector<int>(1, pid), threadGroup)[0];
+    }
+
+    /** Is the kernel accounting delays? (kernel.task_delayacct, Linux >= 5.14 turns it
+	off by default). Without it just cpu delays are there. */
+    static bool accounting()
+    {
+      std::string data = extractFile((_procRoot+"/sys/kernel/task_delayacct").c_str(), 16);
+      return (data.empty()) || (data[0] != '0');
+    }
+  };
+
+  /** Threshold alerts over collected metrics  */
+  namespace Alerts
+  {
+    /** What can we watch. Key is the mount point (or device), process name,
+	cgroup path or PSI resource (cpu, memory, io) depending on the metric. */
+    enum Metric
+      {
+	/* system (no key) */
+	SYS_LOAD1, SYS_LOAD5, SYS_LOAD15, SYS_FREERAM, SYS_USEDRAM, SYS_USEDRAM_RATIO,
+	SYS_FREESWAP, SYS_USEDSWAP, SYS_THREADS,
+	/* pressure (key: cpu, memory or io) */
+	PSI_SOME10, PSI_SOME60, PSI_SOME300, PSI_FULL10, PSI_FULL60, PSI_FULL300,
+	/* cgroups (key: cgroup path) */
+	CGROUP_PCPU, CGROUP_MEMORY, CGROUP_READ_RATE, CGROUP_WRITE_RATE,
+	/* mount points (key: mount point or device) */
+	MOUNT_USED_RATIO, MOUNT_FREE, MOUNT_USED, MOUNT_TOTAL,
+	/* processes by name, all instances summed (key: process name). RSS in bytes */
+	PROC_PCPU, PROC_TOTALPCPU, PROC_COUNT, PROC_RSS, PROC_VSIZE,
+	METRIC_COUNT
+      };
+
+    /** Comparison  */
+    enum Op
+      {
+	GT, GE, LT, LE
+      };
+
+    /** An alert rule  */
+    struct Rule
+    {
+      std::string name;		/* anything to identify it */
+      Metric metric;
+      std::string key;
+      Op op;
+      double threshold;
+      double clearThreshold;	/* hysteresis: alert clears when value goes back past this (NAN = threshold) */
+      double forSeconds;	/* condition must be true this time before firing (debounce) */
+      double clearForSeconds;	/* and false this time before clearing */
+    };
+
+    /** An alert fired or cleared  */
+    struct Event
+    {
+      int rule;			/* rule id */
+      std::string name;
+      bool firing;		/* true: fired, false: cleared */
+      double value;
+      double threshold;		/* crossed: clearThreshold when cleared */
+      std::chrono::system_clock::time_point time;
+    };
+
+    /** Metric names used in text rules (index is Metric) */
+    static const char* metricName(Metric metric)
+    {
+      static const char* names[METRIC_COUNT] = { "load1", "load5", "load15", "freeram", "usedram", "usedramRatio",
+						 "freeswap", "usedswap", "threads",
+						 "some10", "some60", "some300", "full10", "full60", "full300",
+						 "pcpu", "memory", "readRate", "writeRate",
+						 "usedRatio", "free", "used", "total",
+						 "pcpu", "totalpcpu", "count", "rss", "vsize" };
+      return (metric<METRIC_COUNT)?names[metric]:"unknown";
+    }
+
+    /** Rules are compiled into flat tables: one slot per different metric+key
+	and one predicate per rule, both sorted by subsystem, so every metric is
+	collected once and all rules of a subsystem are checked in one pass right
+	after it's refreshed.
+	e.g:
+	  Umon::Alerts::Engine alerts;
+	  alerts.add("mount / usedRatio > 0.9 for 30s clear 0.85");
+	  alerts.add("process nginx pcpu > 400");
+	  alerts.onEvent([](const Umon::Alerts::Event& e) { ... });
+	  alerts.attach();	// or call alerts.evaluate() from time to time */
+    class Engine
+    {
+    public:
+      Engine(): _lastId(0), _dirty(true), _hook(0), _evaluating(false)
+      {
+      }
+
+      ~Engine()
+      {
+	detach();
+      }
+
+      Engine(const Engine&) = delete;
+      Engine& operator=(const Engine&) = delete;
+
+      /** Adds a rule. Returns its id. */
+      int add(Rule rule)
+      {
+	if (std::isnan(rule.clearThreshold))
+	  rule.clearThreshold = rule.threshold;
+	_rules[++_lastId] = rule;
+	_dirty = true;
+	return _lastId;
+      }
+
+      /** Adds a rule from text:
+	    <subject> [key] <metric> <op> <value> [for <time>] [clear <value>] [clearfor <time>]
+	  subjects: system, pressure <resource>, cgroup <path>, mount <mount point>, process [name] <name>
+	  op: > >= < <=. Values admit K, M, G, T suffixes (1024 based) and times s, m, h, ms.
+	  e.g. "mount / usedRatio > 0.9 for 30s", "process name nginx pcpu > 400", "system load1 >= 8 clear 6"
+	  Returns rule id or -1 if it can't be parsed. */
+      int add(std::string text, std::string name="")
+      {
+	std::vector<std::string> tok;
+	size_t pos = 0;
+	while ( (pos = text.find_first_not_of(" \t", pos)) != std::string::npos)
+	  {
+	    size_t end = text.find_first_of(" \t", pos);
+	    tok.push_back(text.substr(pos, end-pos));
+	    pos = end;
+	  }
+
+	Rule r = { (name.empty())?text:name, METRIC_COUNT, "", GT, 0, NAN, 0, 0 };
+	unsigned first, last, i = 1;
+	if (tok.empty())
+	  return -1;
+	if (tok[0] == "system")
+	  {
+	    first = SYS_LOAD1;
+	    last = SYS_THREADS;
+	  }
+	else if ( (tok[0] == "pressure") || (tok[0] == "cgroup") || (tok[0] == "mount") || (tok[0] == "process") )
+	  {
+	    if (tok.size()<2)
+	      return -1;
+	    /* "process name nginx": unless the process is called "name" ("process name pcpu > 400") */
+	    if ( (tok[0] == "process") && (tok[1] == "name") && (tok.size()>2) )
+	      {
+		bool metric = false;
+		for (unsigned m = PROC_PCPU; m<=PROC_VSIZE; ++m)
+		  metric = ( (metric) || (tok[2] == metricName((Metric)m)) );
+		if (!metric)
+		  ++i;
+	      }
+	    r.key = tok[i++];
+	    first = (tok[0] == "pressure")?PSI_SOME10:(tok[0] == "cgroup")?CGROUP_PCPU:(tok[0] == "mount")?MOUNT_USED_RATIO:PROC_PCPU;
+	    last = (tok[0] == "pressure")?PSI_FULL300:(tok[0] == "cgroup")?CGROUP_WRITE_RATE:(tok[0] == "mount")?MOUNT_TOTAL:PROC_VSIZE;
+	  }
+	else
+	  return -1;
+
+	if (tok.size() < i+3)
+	  return -1;
+	for (unsigned m = first; m<=last; ++m)
+	  if (tok[i] == metricName((Metric)m))
+	    r.metric = (Metric)m;
+	if (r.metric == METRIC_COUNT)
+	  return -1;
+	++i;
+
+	if (tok[i] == ">")
+	  r.op = GT;
+	else if (tok[i] == ">=")
+	  r.op = GE;
+	else if (tok[i] == "<")
+	  r.op = LT;
+	else if (tok[i] == "<=")
+	  r.op = LE;
+	else
+	  return -1;
+	++i;
+
+	if (!parseNumber(tok[i++], r.threshold, false))
+	  return -1;
+	while (i+1 < tok.size())
+	  {
+	    bool ok;
+	    if (tok[i] == "for")
+	      ok = parseNumber(tok[i+1], r.forSeconds, true);
+	    else if (tok[i] == "clear")
+	      ok = parseNumber(tok[i+1], r.clearThreshold, false);
+	    else if (tok[i] == "clearfor")
+	      ok = parseNumber(tok[i+1], r.clearForSeconds, true);
+	    else
+	      ok = false;
+	    if (!ok)
+	      return -1;
+	    i+=2;
+	  }
+	if (i != tok.size())
+	  return -1;
+
+	return add(r);
+      }
+
+      /** Removes a rule  */
+      bool remove(int id)
+      {
+	_dirty = true;
+	return (_rules.erase(id) > 0);
+      }
+
+      /** Removes all rules  */
+      void clear()
+      {
+	_rules.clear();
+	_dirty = true;
+      }
+
+      /** Function called when an alert fires or clears  */
+      void onEvent(std::function<void(const Event&)> callback)
+      {
+	_callback = callback;
+      }
+
+      /** Refreshes data used by rules (using the library caches) and checks all rules  */
+      void evaluate()
+      {
+	if (_dirty)
+	  compile();
+
+	_evaluating = true;
+	if (_predStart[1] > _predStart[0])
+	  getSysInfo();
+	if (_predStart[2] > _predStart[1])
+	  Mounts::mountsInfo();
+	if (_predStart[3] > _predStart[2])
+	  Proc::buildProcSummary();
+	_evaluating = false;
+
+	for (unsigned sub=0; sub<SUBSYSTEMS; ++sub)
+	  check(sub);
+      }
+
+      /** Checks rules automatically after every refresh of the data they use  */
+      void attach()
+      {
+	if (_hook)
+	  return;
+
+	_hook = onRefresh([this](RefreshKind kind) {
+	    if (_evaluating)
+	      return;
+	    if (_dirty)
+	      compile();
+	    check((kind == REFRESH_SYSINFO)?SUB_SYSTEM:(kind == REFRESH_MOUNTS)?SUB_MOUNTS:SUB_PROC);
+	  });
+      }
+
+      void detach()
+      {
+	if (_hook)
+	  removeRefreshHook(_hook);
+	_hook = 0;
+      }
+
+      /** Rules firing now  */
+      std::vector<int> firing()
+      {
+	std::vector<int> result;
+	for (auto st : _state)
+	  if (st.second.firing)
+	    result.push_back(st.first);
+	return result;
+      }
+
+      bool isFiring(int id)
+      {
+	auto st = _state.find(id);
+	return (st != _state.end()) && (st->second.firing);
+      }
+
+      /** Last value seen for a rule  */
+      double value(int id)
+      {
+	auto st = _state.find(id);
+	return (st != _state.end())?st->second.value:NAN;
+      }
+
+    private:
+      /* Subsystems. Sysinfo refreshes update system, PSI and cgroup rules */
+      enum
+	{
+	  SUB_SYSTEM, SUB_MOUNTS, SUB_PROC, SUBSYSTEMS
+	};
+
+      /** Rule state, kept across compilations  */
+      struct State
+      {
+	bool firing;
+	int64_t since;		/* condition changed at (ns), 0 = not changing */
+	double value;
+      };
+
+      static unsigned subsystem(Metric m)
+      {
+	return (m<MOUNT_USED_RATIO)?SUB_SYSTEM:(m<PROC_PCPU)?SUB_MOUNTS:SUB_PROC;
+      }
+
+      static bool parseNumber(std::string str, double& val, bool time)
+      {
+	char* end;
+	val = strtod(str.c_str(), &end);
+	if (end == str.c_str())
+	  return false;
+	std::string suffix(end);
+	if (suffix.empty())
+	  return true;
+	if (time)
+	  {
+	    if (suffix == "ms")
+	      val/=1000;
+	    else if (suffix == "m")
+	      val*=60;
+	    else if (suffix == "h")
+	      val*=3600;
+	    else if (suffix != "s")
+	      return false;
+	    return true;
+	  }
+	static const char units[] = "KMGT";
+	const char* u = (suffix.size()==1)?strchr(units, suffix[0]):NULL;
+	if ( (u == NULL) || (*u == '\0') )
+	  return false;
+	val*=pow(1024, u-units+1);
+	return true;
+      }
+
+      /** Builds flat tables from rules  */
+      void compile()
+      {
+	std::vector<std::pair<unsigned, int> > order;	/* (subsystem, rule id) */
+	std::map<std::pair<int, std::string>, unsigned> slots;
+
+	_slotMetric.clear();
+	_slotKey.clear();
+	_procKeys.clear();
+	_predRule.clear();
+	_predSlot.clear();
+	_predOp.clear();
+	_predThreshold.clear();
+	_predClear.clear();
+	_predFor.clear();
+	_predClearFor.clear();
+
+	for (auto r : _rules)
+	  order.push_back(std::make_pair(subsystem(r.second.metric), r.first));
+	std::sort(order.begin(), order.end());
+
+	unsigned sub = 0;
+	_predStart[0] = 0;
+	for (auto o : order)
+	  {
+	    Rule& r = _rules[o.second];
+	    while (sub < o.first)
+	      _predStart[++sub] = _predRule.size();
+
+	    auto key = std::make_pair((int)r.metric, r.key);
+	    auto slot = slots.find(key);
+	    if (slot == slots.end())
+	      {
+		slot = slots.insert(std::make_pair(key, (unsigned)_slotMetric.size())).first;
+		_slotMetric.push_back(r.metric);
+		_slotKey.push_back(r.key);
+		if ( (sub == SUB_PROC) && (std::find(_procKeys.begin(), _procKeys.end(), r.key) == _procKeys.end()) )
+		  _procKeys.push_back(r.key);
+	      }
+	    _predRule.push_back(o.second);
+	    _predSlot.push_back(slot->second);
+	    _predOp.push_back(r.op);
+	    _predThreshold.push_back(r.threshold);
+	    _predClear.push_back(r.clearThreshold);
+	    _predFor.push_back((int64_t)(r.forSeconds*1e9));
+	    _predClearFor.push_back((int64_t)(r.clearForSeconds*1e9));
+	    if (_state.find(o.second) == _state.end())
+	      _state[o.second] = State({false, 0, NAN});
+	  }
+	while (sub < SUBSYSTEMS)
+	  _predStart[++sub] = _predRule.size();
+
+	/* Forget removed rules */
+	for (auto i = _state.begin(); i!=_state.end(); )
+	  {
+	    if (_rules.find(i->first) == _rules.end())
+	      i = _state.erase(i);
+	    else
+	      ++i;
+	  }
+
+	_values.assign(_slotMetric.size(), NAN);
+	_procValues.assign(_procKeys.size()*5, 0);
+	_dirty = false;
+      }
+
+      /** Gets values of all slots of a subsystem. Data must be already refreshed. */
+      void collect(unsigned sub)
+      {
+	if (sub == SUB_SYSTEM)
+	  {
+	    struct sysinfo si = getSysInfo();
+	    for (unsigned s=0; s<_slotMetric.size(); ++s)
+	      {
+		Metric m = _slotMetric[s];
+		if (subsystem(m) != SUB_SYSTEM)
+		  continue;
+		if (m<PSI_SOME10)
+		  {
+		    static const double load = 1 << SI_LOAD_SHIFT;
+		    double values[] = { si.loads[0]/load, si.loads[1]/load, si.loads[2]/load,
+					(double)si.freeram*si.mem_unit, (double)(si.totalram-si.freeram)*si.mem_unit,
+					(si.totalram)?1-(double)si.freeram/si.totalram:0,
+					(double)si.freeswap*si.mem_unit, (double)(si.totalswap-si.freeswap)*si.mem_unit,
+					(double)si.procs };
+		    _values[s] = values[m-SYS_LOAD1];
+		  }
+		else if (m<CGROUP_PCPU)
+		  {
+		    PressureResource res = (_slotKey[s]=="cpu")?PRESSURE_CPU:(_slotKey[s]=="io")?PRESSURE_IO:PRESSURE_MEMORY;
+		    Pressure p = getPressure(res);
+		    double values[] = { p.some.avg10, p.some.avg60, p.some.avg300, p.full.avg10, p.full.avg60, p.full.avg300 };
+		    _values[s] = (p.error)?NAN:values[m-PSI_SOME10];
+		  }
+		else
+		  {
+		    cgroup_t* cg = getCgroup(_slotKey[s], false);
+		    double values[] = { cg->st.pcpu, (double)cg->st.memoryCurrent, cg->st.readRate, cg->st.writeRate };
+		    _values[s] = (cg->st.error)?NAN:values[m-CGROUP_PCPU];
+		  }
+	      }
+	  }
+	else if (sub == SUB_MOUNTS)
+	  {
+	    for (unsigned s=0; s<_slotMetric.size(); ++s)
+	      if (subsystem(_slotMetric[s]) == SUB_MOUNTS)
+		_values[s] = NAN;	/* not mounted */
+
+	    for (auto m : MountSummary.points)
+	      for (unsigned s=0; s<_slotMetric.size(); ++s)
+		{
+		  if ( (subsystem(_slotMetric[s]) != SUB_MOUNTS) ||
+		       ( (m.fileSystem != _slotKey[s]) && (m.mountPoint != _slotKey[s]) ) )
+		    continue;
+		  double values[] = { m.usedRatio(), (double)m.freeSpace(), (double)m.usedSpace(), (double)m.totalSpace() };
+		  _values[s] = (m.statfs_errno)?NAN:values[_slotMetric[s]-MOUNT_USED_RATIO];
+		}
+	  }
+	else if (!_procKeys.empty())
+	  {
+	    /* One pass over processes summing every name we want */
+	    std::fill(_procValues.begin(), _procValues.end(), 0);
+	    for (auto p : ProcessSummary.processes)
+	      {
+		proc_t* P = p.second;
+		if (P == NULL)
+		  continue;
+		for (unsigned k=0; k<_procKeys.size(); ++k)
+		  if (strcmp(P->name, _procKeys[k].c_str()) == 0)
+		    {
+		      double* v = &_procValues[k*5];
+		      v[0]+=P->pcpu;
+		      v[1]+=P->totalpcpu;
+		      v[2]+=1;
+		      v[3]+=(double)P->rss*pageSize();
+		      v[4]+=P->vsize;
+		      break;
+		    }
+	      }
+	    for (unsigned s=0; s<_slotMetric.size(); ++s)
+	      if (subsystem(_slotMetric[s]) == SUB_PROC)
+		{
+		  unsigned k = std::find(_procKeys.begin(), _procKeys.end(), _slotKey[s]) - _procKeys.begin();
+		  _values[s] = _procValues[k*5+_slotMetric[s]-PROC_PCPU];
+		}
+	  }
+      }
+
+      /** Checks all predicates of a subsystem  */
+      void check(unsigned sub)
+      {
+	if (_predStart[sub+1] == _predStart[sub])
+	  return;
+
+	collect(sub);
+	int64_t now = statsNow();
+	for (unsigned i=_predStart[sub]; i<_predStart[sub+1]; ++i)
+	  {
+	    State& st = _state[_predRule[i]];
+	    double v = _values[_predSlot[i]];
+	    double t = (st.firing)?_predClear[i]:_predThreshold[i];
+	    st.value = v;
+	    /* Metric not available now (statfs() timeout, unmounted, read error): no
+	       change, the alert keeps its state and time waiting */
+	    if (std::isnan(v))
+	      continue;
+	    bool active;
+	    switch (_predOp[i])
+	      {
+	      case GT: active = v>t; break;
+	      case GE: active = v>=t; break;
+	      case LT: active = v<t; break;
+	      default: active = v<=t;
+	      }
+	    if (active == st.firing)
+	      {
+		st.since = 0;
+		continue;
+	      }
+	    if (st.since == 0)
+	      st.since = now;
+	    if (now - st.since < ((st.firing)?_predClearFor[i]:_predFor[i]))
+	      continue;
+
+	    st.firing = active;
+	    st.since = 0;
+	    if (_callback)
+	      _callback(Event({_predRule[i], _rules[_predRule[i]].name, active, v, t,
+			       std::chrono::system_clock::now()}));
+	  }
+      }
+
+      std::map<int, Rule> _rules;
+      std::map<int, State> _state;
+      int _lastId;
+      bool _dirty;
+      unsigned _hook;
+      bool _evaluating;
+      std::function<void(const Event&)> _callback;
+
+      /* Compiled tables */
+      std::vector<Metric> _slotMetric;
+      std::vector<std::string> _slotKey;
+      std::vector<double> _values;
+      std::vector<std::string> _procKeys;	/* process names we sum */
+      std::vector<double> _procValues;	/* pcpu, totalpcpu, count, rss, vsize per name */
+      std::vector<int> _predRule;
+      std::vector<unsigned> _predSlot;
+      std::vector<unsigned char> _predOp;
+      std::vector<double> _predThreshold;
+      std::vector<double> _predClear;
+      std::vector<int64_t> _predFor;
+      std::vector<int64_t> _predClearFor;
+      unsigned _predStart[SUBSYSTEMS+1];
+    };
+  };
+
+  /** Metric history in a fixed-size memory-mapped ring file, so we know what
+      happened before a crash. Each record has a CRC32 and the reader only takes
+      valid ones, so a record half written doesn't break the file.
+      Records are keyframes (all values) or deltas from the previous record
+      (changed values only, as zigzag varints), so most records take some
+      hundred bytes.
+      e.g:
+	Umon::History::Recorder rec;
+	rec.open("/var/lib/umon/history", 64*1024*1024);
+	rec.attach();		// a record after every process summary built
+	...
+	Umon::History::Reader reader;
+	reader.open("/var/lib/umon/history");
+	reader.replay([](const Umon::History::Sample& s) { ... return true; }); */
+  namespace History
+  {
+    /** System values. Memory in bytes */
+    enum SystemField
+      {
+	SYS_TOTALRAM, SYS_FREERAM, SYS_SHAREDRAM, SYS_BUFFERRAM, SYS_TOTALSWAP, SYS_FREESWAP,
+	SYS_THREADS, SYS_LOAD1, SYS_LOAD5, SYS_LOAD15, SYSTEM_FIELDS
+      };
+
+    /** Mount point values. Space in bytes */
+    enum MountField
+      {
+	MOUNT_TOTAL, MOUNT_FREE, MOUNT_USED, MOUNT_FILES, MOUNT_FREEFILES, MOUNT_FIELDS
+      };
+
+    /** Processes by name, all instances summed (see Proc::buildAdvancedSummary()). Memory in bytes */
+    enum ProcessField
+      {
+	PROC_COUNT, PROC_PCPU, PROC_TOTALPCPU, PROC_VSIZE, PROC_RSS, PROC_PSS, PROCESS_FIELDS
+      };
+
+    /** A sample, as the reader gives it  */
+    struct Sample
+    {
+      uint64_t sequence;
+      std::chrono::system_clock::time_point time;
+      bool keyframe;
+      double system[SYSTEM_FIELDS];
+      std::map<std::string, std::vector<double>> mounts;	/* by mount point, MountField values */
+      std::map<std::string, std::vector<double>> processes;	/* by name, ProcessField values */
+    };
+  };
+
+  namespace Internal
+  {
+    /** History file record header  */
+    struct HistoryRecord
+    {
+      uint32_t magic;
+      uint32_t length;		/* bytes, header included, 8 aligned */
+      uint64_t sequence;
+      int64_t time;		/* microseconds since epoch */
+      uint32_t flags;		/* 1: keyframe */
+      uint32_t crc;		/* CRC32 of the record with crc=0 */
+    };
+
+    const unsigned HISTORY_MAX_FIELDS = 16;
+
+    /** Something we record values of (the system, a mount point or a process name) */
+    struct HistoryEntity
+    {
+      unsigned kind;
+      std::string name;
+      bool present;		/* defined in the file since last keyframe */
+      bool seen;		/* in this record */
+      int64_t values[HISTORY_MAX_FIELDS];
+    };
+  };
+
+  /* History files private stuff */
+  namespace
+  {
+    using Internal::HistoryRecord;
+    using Internal::HistoryEntity;
+    using Internal::HISTORY_MAX_FIELDS;
+
+    /* File: a header and a ring of records, 8 bytes aligned. Our own byte order. */
+    const uint64_t HISTORY_MAGIC = 0x315349484e4f4d55ULL; /* "UMONHIS1" */
+    const uint32_t HISTORY_RECORD_MAGIC = 0x43524d55;	   /* "UMRC" */
+    const unsigned HISTORY_HEADER_SIZE = 4096;
+
+    enum
+      {
+	HISTORY_SYSTEM, HISTORY_MOUNT, HISTORY_PROCESS, HISTORY_KINDS
+      };
+    const unsigned historyFields[HISTORY_KINDS] = { History::SYSTEM_FIELDS, History::MOUNT_FIELDS, History::PROCESS_FIELDS };
+
+    /* Record entries begin with a tag: entity index << 2 | type */
+    enum
+      {
+	HISTORY_DELTA = 1,	/* changed fields mask + deltas. Never 0: 0 is padding */
+	HISTORY_DEFINE,		/* kind, name and all fields */
+	HISTORY_REMOVE		/* entity is gone */
+      };
+
+    struct HistoryFileHeader
+    {
+      uint64_t magic;
+      uint32_t version;
+      uint32_t headerSize;
+      uint64_t capacity;	/* ring size (bytes) */
+    };
+
+    /** CRC32 (IEEE)  */
+    uint32_t historyCrc32(const uint8_t* data, size_t len, uint32_t crc=0)
+    {
+      static uint32_t table[256];
+      static bool tableReady = false;
+      if (!tableReady)
+	{
+	  for (uint32_t i=0; i<256; ++i)
+	    {
+	      uint32_t c = i;
+	      for (unsigned k=0; k<8; ++k)
+		c = (c & 1)?(0xedb88320 ^ (c >> 1)):(c >> 1);
+	      table[i] = c;
+	    }
+	  tableReady = true;
+	}
+
+      crc = ~crc;
+      while (len--)
+	crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+      return ~crc;
+    }
+
+    /** CRC of a record with header h (its length) and its payload, as if its crc
+	field were 0 and its magic were written */
+    uint32_t historyRecordCrc(const HistoryRecord& header, const uint8_t* payload)
+    {
+      HistoryRecord h = header;
+      h.magic = HISTORY_RECORD_MAGIC;
+      h.crc = 0;
+      uint32_t crc = historyCrc32((const uint8_t*)&h, sizeof(h));
+      return historyCrc32(payload, h.length - sizeof(h), crc);
+    }
+
+    /** Calls f with every valid record in the ring, in file order. Headers are
+	copied before they are checked: a recorder can be writing the file */
+    void historyScan(const uint8_t* ring, uint64_t capacity, std::function<void(const HistoryRecord*, uint64_t)> f)
+    {
+      for (uint64_t off = 0; off + sizeof(HistoryRecord) <= capacity; )
+	{
+	  HistoryRecord h;
+	  memcpy(&h, ring+off, sizeof(h));
+	  if ( (h.magic == HISTORY_RECORD_MAGIC) && (h.length >= sizeof(HistoryRecord)) &&
+	       (h.length % 8 == 0) && (off + h.length <= capacity) &&
+	       (historyRecordCrc(h, ring+off+sizeof(h)) == h.crc) )
+	    {
+	      f((const HistoryRecord*)(ring+off), off);
+	      off+=h.length;
+	    }
+	  else
+	    off+=8;
+	}
+    }
+
+    /** Bounded output buffer. ok will be false if something didn't fit */
+    struct HistoryWriter
+    {
+      uint8_t *pos, *end;
+      bool ok;
+
+      void put(uint8_t b)
+      {
+	if (pos < end)
+	  *pos++ = b;
+	else
+	  ok = false;
+      }
+
+      void varint(uint64_t v)
+      {
+	while (v >= 0x80)
+	  {
+	    put(v | 0x80);
+	    v>>=7;
+	  }
+	put(v);
+      }
+
+      void zigzag(int64_t v)
+      {
+	varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+      }
+
+      void bytes(const char* data, size_t len)
+      {
+	if (pos + len <= end)
+	  {
+	    memcpy(pos, data, len);
+	    pos+=len;
+	  }
+	else
+	  ok = false;
+      }
+    };
+
+    /** Bounded input buffer. ok will be false if we went past the end */
+    struct HistoryParser
+    {
+      const uint8_t *pos, *end;
+      bool ok;
+
+      uint64_t varint()
+      {
+	uint64_t v = 0;
+	for (unsigned shift = 0; shift < 64; shift+=7)
+	  {
+	    if (pos >= end)
+	      break;
+	    uint8_t b = *pos++;
+	    v|=(uint64_t)(b & 0x7f) << shift;
+	    if ((b & 0x80) == 0)
+	      return v;
+	  }
+	ok = false;
+	return 0;
+      }
+
+      int64_t zigzag()
+      {
+	uint64_t v = varint();
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+      }
+    };
+
+    /** Values are stored as integers. Loads are fixed point (as sysinfo gives
+	them) and %CPU in hundredths */
+    double historyValue(unsigned kind, unsigned field, int64_t value)
+    {
+      if ( (kind == HISTORY_SYSTEM) && (field >= History::SYS_LOAD1) )
+	return value / (double)(1 << SI_LOAD_SHIFT);
+      if ( (kind == HISTORY_PROCESS) && ( (field == History::PROC_PCPU) || (field == History::PROC_TOTALPCPU) ) )
+	return value / 100.0;
+      return value;
+    }
+  };
+
+  namespace History
+  {
+    /** Writes records to a history file. Writing doesn't allocate memory once
+	all entities (mount points and process names) have been seen, and takes
+	microseconds. Data goes to the page cache, so a crash of the program
+	loses nothing. Call flush() to be safe if the whole host goes down. */
+    class Recorder
+    {
+    public:
+      Recorder(): _fd(-1), _map(NULL), _mapSize(0), _capacity(0), _writePos(0), _sequence(0),
+		  _keyframeInterval(60), _sinceKeyframe(0), _topProcesses(32), _hook(0), _error(0)
+      {
+	_top.reserve(_topProcesses*2);
+      }
+
+      ~Recorder()
+      {
+	close();
+      }
+
+      Recorder(const Recorder&) = delete;
+      Recorder& operator=(const Recorder&) = delete;
+
+      /** Opens or creates a history file with a ring of capacity bytes. An
+	  existing file keeps its capacity and new records go after its last one. */
+      bool open(std::string path, uint64_t capacity=16*1024*1024)
+      {
+	close();
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd == -1)
+	  return fail();
+
+	HistoryFileHeader header;
+	struct stat st;
+	if (fstat(_fd, &st) == -1)
+	  return fail();
+	bool existing = ( (pread(_fd, &header, sizeof(header), 0) == sizeof(header)) &&
+			  (header.magic == HISTORY_MAGIC) && (header.version == 1) &&
+			  (header.headerSize == HISTORY_HEADER_SIZE) &&
+			  ((uint64_t)st.st_size == HISTORY_HEADER_SIZE + header.capacity) );
+	if (existing)
+	  capacity = header.capacity;
+	else
+	  {
+	    capacity = (capacity + 7) & ~7ULL;
+	    header = HistoryFileHeader({HISTORY_MAGIC, 1, HISTORY_HEADER_SIZE, capacity});
+	    /* Blocks reserved now: no SIGBUS writing to the map with a full disk */
+	    if ( (capacity < 4096) || (ftruncate(_fd, 0) == -1) ||
+		 ((errno = posix_fallocate(_fd, 0, HISTORY_HEADER_SIZE + capacity)) != 0) ||
+		 (pwrite(_fd, &header, sizeof(header), 0) != sizeof(header)) )
+	      return fail((capacity < 4096)?EINVAL:errno);
+	  }
+
+	_mapSize = HISTORY_HEADER_SIZE + capacity;
+	_map = (uint8_t*)mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_map == (uint8_t*)MAP_FAILED)
+	  {
+	    _map = NULL;
+	    return fail();
+	  }
+	_capacity = capacity;
+	_writePos = 0;
+	_sequence = 0;
+	if (existing)
+	  historyScan(ring(), _capacity, [this](const HistoryRecord* r, uint64_t off) {
+	      if (r->sequence >= _sequence)
+		{
+		  _sequence = r->sequence + 1;
+		  _writePos = off + r->length;
+		}
+	    });
+
+	/* Biggest record we can write */
+	_scratch.resize(std::min<uint64_t>(_capacity/2, 1024*1024) & ~7ULL);
+	_entities.clear();
+	for (unsigned k=0; k<HISTORY_KINDS; ++k)
+	  _names[k].clear();
+	entity(HISTORY_SYSTEM, "");
+	_sinceKeyframe = _keyframeInterval; /* We begin with a keyframe */
+	_error = 0;
+	return true;
+      }
+
+      /** Writes a record with what the library has now: sysinfo (refreshed if
+	  needed), mount points and processes by name (summed here from the last
+	  process summary, no advanced summary needed). Just topProcesses() names
+	  with more %CPU. */
+      bool record()
+      {
+	if (_map == NULL)
+	  return false;
+
+	uint64_t start = statsNow();
+	bool keyframe = (_sinceKeyframe >= _keyframeInterval);
+	if (keyframe)
+	  compact();
+	for (auto& e : _entities)
+	  e.seen = false;
+
+	HistoryWriter w({ &_scratch[0] + sizeof(HistoryRecord), &_scratch[0] + _scratch.size(), true });
+	auto si = getSysInfo();
+	int64_t values[HISTORY_MAX_FIELDS] = { (int64_t)si.totalram * si.mem_unit, (int64_t)si.freeram * si.mem_unit,
+					       (int64_t)si.sharedram * si.mem_unit, (int64_t)si.bufferram * si.mem_unit,
+					       (int64_t)si.totalswap * si.mem_unit, (int64_t)si.freeswap * si.mem_unit,
+					       si.procs, (int64_t)si.loads[0], (int64_t)si.loads[1], (int64_t)si.loads[2] };
+	encode(w, 0, values, keyframe);
+
+	for (auto& m : MountSummary.points)
+	  {
+	    int64_t mv[HISTORY_MAX_FIELDS] = { (int64_t)m.totalSpace(), (int64_t)m.freeSpace(), (int64_t)m.usedSpace(),
+					       (int64_t)m.fileNodes, (int64_t)m.freeFileNodes };
+	    encode(w, entity(HISTORY_MOUNT, m.mountPoint), mv, keyframe);
+	  }
+
+	/* Processes by name. Names are kept from one record to the next, so
+	   there are no allocations unless names change */
+	if (_topProcesses)
+	  {
+	    for (auto& n : _byName)
+	      n.second = TopName();
+	    for (auto& p : ProcessSummary.processes)
+	      {
+		const proc_t* P = p.second;
+		TopName& t = _byName[P->name];
+		++t.count;
+		t.pcpu+=P->pcpu;
+		t.totalpcpu+=P->totalpcpu;
+		t.totalvsize+=P->vsize;
+		t.totalrss+=P->rss;
+		t.totalpss+=P->pss;
+	      }
+	  }
+	_top.clear();
+	for (auto n=_byName.begin(); n!=_byName.end(); )
+	  {
+	    if (!n->second.count)
+	      {
+		n = _byName.erase(n);
+		continue;
+	      }
+	    _top.push_back(std::make_pair(n->second.pcpu, &*n));
+	    ++n;
+	  }
+	if (_top.size() > _topProcesses)
+	  {
+	    std::nth_element(_top.begin(), _top.begin()+_topProcesses, _top.end(),
+			     [](const std::pair<double, const TopEntry*>& a,
+				const std::pair<double, const TopEntry*>& b) { return a.first > b.first; });
+	    _top.resize(_topProcesses);
+	  }
+	long pageSize = sysconf(_SC_PAGESIZE);
+	for (auto& t : _top)
+	  {
+	    const TopName& p = t.second->second;
+	    int64_t pv[HISTORY_MAX_FIELDS] = { p.count, llround(p.pcpu*100), llround(p.totalpcpu*100),
+					       (int64_t)p.totalvsize, (int64_t)p.totalrss * pageSize,
+					       (int64_t)p.totalpss };
+	    encode(w, entity(HISTORY_PROCESS, t.second->first), pv, keyframe);
+	  }
+
+	/* Entities we don't see anymore */
+	for (unsigned i=0; i<_entities.size(); ++i)
+	  if ( (_entities[i].present) && (!_entities[i].seen) )
+	    {
+	      _entities[i].present = false;
+	      if (!keyframe)
+		w.varint(((uint64_t)i << 2) | HISTORY_REMOVE);
+	    }
+
+	uint64_t length = ((w.pos - &_scratch[0]) + 7) & ~7ULL;
+	if (w.ok)
+	  memset(w.pos, 0, &_scratch[0] + length - w.pos); /* padding */
+	else
+	  {
+	    /* Too big. The reader will see a hole and wait for the next keyframe */
+	    ++_sequence;
+	    _sinceKeyframe = _keyframeInterval;
+	    return fail(EOVERFLOW);
+	  }
+	write(length, keyframe);
+	statsRecord(Stats::HISTORY, statsNow()-start);
+	return true;
+      }
+
+      /** Writes a record after every process summary built  */
+      void attach()
+      {
+	if (_hook)
+	  return;
+
+	_hook = onRefresh([this](RefreshKind kind) {
+	    if (kind == REFRESH_PROC)
+	      record();
+	  });
+      }
+
+      void detach()
+      {
+	if (_hook)
+	  removeRefreshHook(_hook);
+	_hook = 0;
+      }
+
+      /** Writes everything to disk now (msync)  */
+      bool flush()
+      {
+	if (_map == NULL)
+	  return false;
+	if (msync(_map, _mapSize, MS_SYNC) == -1)
+	  return fail();
+	return true;
+      }
+
+      void close()
+      {
+	detach();
+	if (_map)
+	  munmap(_map, _mapSize);
+	if (_fd != -1)
+	  ::close(_fd);
+	_map = NULL;
+	_fd = -1;
+      }
+
+      /* keyframe interval getter/s (records). A lost record costs at most this */
+      unsigned keyframeInterval()
+      {
+	return _keyframeInterval;
+      }
+
+      unsigned keyframeInterval(unsigned val)
+      {
+	if (val > 0)
+	  _keyframeInterval = val;
+	return _keyframeInterval;
+      }
+
+      /* top processes getter/s. Process names recorded (the ones using more CPU) */
+      unsigned topProcesses()
+      {
+	return _topProcesses;
+      }
+
+      unsigned topProcesses(unsigned val)
       {
-	DIR* proc_dir;
-	direct *ent;
+	_topProcesses = val;
+	_top.reserve(val*2);
+	return _topProcesses;
+      }
 
-	proc_dir = opendir("/proc");
-	while ((ent = readdir(proc_dir)))
-	  {
-	    if ((*ent->d_name>'0') && (*ent->d_name<='9')) /* Be sure it's a pid */
-	      {
-		/* snprintf(filename, 32, "/proc/%s/stat", ent->d_name); */
-		if (!f(ent->d_name))
-		  break;
-	      }
-	  }
-	closedir(proc_dir);
+      /** Next sequence number  */
+      uint64_t sequence()
+      {
+	return _sequence;
       }
 
-      /** Cleanup processes not seen in a while (finished processes)  */
-      void processedCleanup()
+      /** errno of last error, 0 if none  */
+      int error()
       {
-	for (auto i=ProcessSummary.processes.rbegin(); i!=ProcessSummary.processes.rend(); ++i)
-	  if (i->second->updated < lastProcessUpdate-1) /* No cleanup of just dead processes */
-	    ProcessSummary.processes.erase(std::next(i).base());
-	/* std::cout << "REMOVE: "<<i->second->pid<<std::endl; */
+	return _error;
       }
-    };
 
-  /** Processes public functions  */
- namespace Proc
- {
-   /** build process internal summary. Many functions will build the entire process summary
-       as it isn't too expensive, save programming time and these functions won't be used just
-       once for a single process. My intention is to iterate over processes each time. */
-   static void buildProcSummary(bool reload=false)
-   {
-     static std::chrono::steady_clock::time_point _procsum_tp; /* last sysinfo fetched */
-     auto now = std::chrono::steady_clock::now();
-     if ( (reload) || (_procsum_tp+proccessSummaryRebuild < now) )
-       {
-	 double elapsedTime = std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(now-_procsum_tp).count();
-	 walkProcesses(std::bind(createProcessSummary, std::placeholders::_1, elapsedTime, ++lastProcessUpdate));
-	 processedCleanup();
-	 _procsum_tp = std::chrono::steady_clock::now();
-       }
+    private:
+      bool fail(int err=-1)
+      {
+	_error = (err == -1)?errno:err;
+	return false;
+      }
 
-     ProcessSummary.generationTime = (std::chrono::steady_clock::now() - now);
-   }
+      uint8_t* ring()
+      {
+	return _map + HISTORY_HEADER_SIZE;
+      }
 
-   /** build advanced process summary. Automatically calls buildProcSummary()  */
-   static void buildAdvancedSummary(bool reload=false)
-   {
-     buildProcSummary(reload);
-     static std::chrono::steady_clock::time_point _procsum_tp; /* last sysinfo fetched */
-     auto now = std::chrono::steady_clock::now();
-     if ( (reload) || (_procsum_tp+proccessSummaryRebuild < now) )
-       {
-	 ProcessSummary.advanced.clear();
-	 for (auto p : ProcessSummary.processes)
-	   {
-	     auto _p = p.second;
-	     SingleProc sp({_p->name, _p->state, _p->error, _p->pid,
-		   _p->ppid, _p->pgrp,      _p->session, _p->tty,
-		   _p->pcpu, _p->totalpcpu, _p->flags,   _p->vsize,
-		   _p->start_time, _p->priority, _p->nice, _p->rss});
-	     auto item = ProcessSummary.advanced.find(_p->name);
-	     if (item == ProcessSummary.advanced.end())
-	       {
-		 MultiProc mp({_p->name, _p->pcpu, _p->totalpcpu, _p->vsize,
-		       _p->rss, 1});
-		 mp.processes[_p->pid] = sp;
-		 ProcessSummary.advanced[_p->name] = mp;
-	       }
-	     else
-	       {
-		 item->second.pcpu+=_p->pcpu;
-		 item->second.totalpcpu+=_p->totalpcpu;
-		 item->second.totalvsize+=_p->vsize;
-		 item->second.totalrss+=_p->rss;
-		 ++item->second.count;
-		 item->second.processes[_p->pid] = sp;
-	       }
-	   }
-       }
-   }
+      /** Entity index for a name, created if it's new */
+      unsigned entity(unsigned kind, const std::string& name)
+      {
+	auto it = _names[kind].find(name);
+	if (it != _names[kind].end())
+	  return it->second;
+
+	HistoryEntity e;
+	e.kind = kind;
+	e.name = name;
+	e.present = false;
+	e.seen = false;
+	_entities.push_back(e);
+	_names[kind][name] = _entities.size()-1;
+	return _entities.size()-1;
+      }
 
-   /** Returns time taken to build the summary  */
-   static double timeToBuildSummary()
-   {
-     return std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1>>>(ProcessSummary.generationTime).count();
-   }
+      /** Before a keyframe: forget entities not present if they are too many  */
+      void compact()
+      {
+	unsigned present = 0;
+	for (auto& e : _entities)
+	  present+=e.present;
+	if (_entities.size() < 2*present + 64)
+	  return;
+
+	std::vector<HistoryEntity> entities;
+	for (unsigned k=0; k<HISTORY_KINDS; ++k)
+	  _names[k].clear();
+	for (unsigned i=0; i<_entities.size(); ++i)
+	  if ( (i == 0) || (_entities[i].present) )
+	    {
+	      _names[_entities[i].kind][_entities[i].name] = entities.size();
+	      entities.push_back(_entities[i]);
+	    }
+	_entities.swap(entities);
+      }
 
-   /** another process count, this time with our process map  */
-   static unsigned processCount()
-   {
-     buildProcSummary();
-     return ProcessSummary.processes.size();
-   }
+      /** Writes an entity entry. The whole entity if it's new (or in a keyframe),
+	  else just changed values */
+      void encode(HistoryWriter& w, unsigned index, const int64_t* values, bool keyframe)
+      {
+	HistoryEntity& e = _entities[index];
+	unsigned fields = historyFields[e.kind];
+	e.seen = true;
+	if ( (keyframe) || (!e.present) )
+	  {
+	    w.varint(((uint64_t)index << 2) | HISTORY_DEFINE);
+	    w.varint(e.kind);
+	    w.varint(e.name.size());
+	    w.bytes(e.name.c_str(), e.name.size());
+	    for (unsigned f=0; f<fields; ++f)
+	      w.zigzag(e.values[f] = values[f]);
+	    e.present = true;
+	    return;
+	  }
 
-   /** count processes with given name  */
-   static unsigned countProcess(std::string name)
-   {
-     buildProcSummary();
-     buildAdvancedSummary();
+	uint64_t mask = 0;
+	for (unsigned f=0; f<fields; ++f)
+	  if (values[f] != e.values[f])
+	    mask|=1 << f;
+	if (mask == 0)
+	  return;
+
+	w.varint(((uint64_t)index << 2) | HISTORY_DELTA);
+	w.varint(mask);
+	for (unsigned f=0; f<fields; ++f)
+	  if (mask & (1 << f))
+	    {
+	      w.zigzag(values[f] - e.values[f]);
+	      e.values[f] = values[f];
+	    }
+      }
 
-     auto it = ProcessSummary.advanced.find(name);
-     if (it == ProcessSummary.advanced.end())
-       return 0;
-     return it->second.count;
-   }
+      /** Copies the record in scratch to the ring. Magic is written the last,
+	  so a half written record is never valid. */
+      void write(uint64_t length, bool keyframe)
+      {
+	if (_writePos + length > _capacity)
+	  _writePos = 0;	/* Records don't wrap. Old ones after them are still valid */
+
+	HistoryRecord* r = (HistoryRecord*)(ring() + _writePos);
+	__atomic_store_n(&r->magic, 0, __ATOMIC_RELEASE);
+	HistoryRecord* h = (HistoryRecord*)&_scratch[0];
+	h->magic = HISTORY_RECORD_MAGIC;
+	h->length = length;
+	h->sequence = _sequence;
+	h->time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	h->flags = (keyframe)?1:0;
+	h->crc = 0;
+	h->crc = historyRecordCrc(*h, (const uint8_t*)(h+1));
+	memcpy((uint8_t*)r + sizeof(uint32_t), (uint8_t*)h + sizeof(uint32_t), length - sizeof(uint32_t));
+	__atomic_store_n(&r->magic, HISTORY_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+	_writePos+=length;
+	++_sequence;
+	_sinceKeyframe = (keyframe)?1:_sinceKeyframe+1;
+      }
 
-   /** total %CPU by a given process. If allTime is true, the % will be
-       calculated from the process start. If not, it will be calculated from
-       the last call to any process function (as it uses buildProcSummary). */
-   static double totalPCPU(std::string name, bool allTime=false)
-   {
-     buildProcSummary();
-     buildAdvancedSummary();
+      int _fd;
+      uint8_t* _map;
+      size_t _mapSize;
+      uint64_t _capacity;
+      uint64_t _writePos;
+      uint64_t _sequence;
+      unsigned _keyframeInterval;
+      unsigned _sinceKeyframe;
+      unsigned _topProcesses;
+      unsigned _hook;
+      int _error;
+      std::vector<uint8_t> _scratch;
+      std::vector<HistoryEntity> _entities;
+      std::map<std::string, unsigned> _names[HISTORY_KINDS];
+
+      /** Processes with a name, summed in record()  */
+      struct TopName
+      {
+	unsigned count;
+	double pcpu, totalpcpu;
+	unsigned long long totalvsize, totalpss;
+	long totalrss;
+      };
+      typedef std::pair<const std::string, TopName> TopEntry;
+      std::unordered_map<std::string, TopName> _byName;
+      std::vector<std::pair<double, const TopEntry*>> _top;
+    };
 
-     auto it = ProcessSummary.advanced.find(name);
-     if (it == ProcessSummary.advanced.end())
-       return 0;
+    /** Reads a history file (it can be being written). */
+    class Reader
+    {
+    public:
+      Reader(): _fd(-1), _map(NULL), _mapSize(0), _capacity(0), _error(0)
+      {
+      }
 
-     return (allTime)?it->second.totalpcpu:it->second.pcpu;
-   }
+      ~Reader()
+      {
+	close();
+      }
 
-   /** Get all processes with a given name in a MultiProc  */
-   static MultiProc getByName(std::string name)
-   {
-     buildAdvancedSummary();
-     return ProcessSummary.advanced[name];
-   }
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
 
-   /** Get all processes information */
-   static std::map<unsigned, SingleProc> getAllProcs()
-   {
-     std::map<unsigned, SingleProc> result;
-     buildProcSummary();
+      bool open(std::string path)
+      {
+	close();
+	HistoryFileHeader header;
+	struct stat st;
+	_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( (_fd == -1) || (fstat(_fd, &st) == -1) )
+	  return fail(errno);
+	if ( (pread(_fd, &header, sizeof(header), 0) != sizeof(header)) || (header.magic != HISTORY_MAGIC) ||
+	     (header.version != 1) || (header.headerSize != HISTORY_HEADER_SIZE) ||
+	     ((uint64_t)st.st_size != HISTORY_HEADER_SIZE + header.capacity) )
+	  return fail(EINVAL);
+
+	_mapSize = st.st_size;
+	_map = (uint8_t*)mmap(NULL, _mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+	if (_map == (uint8_t*)MAP_FAILED)
+	  {
+	    _map = NULL;
+	    return fail(errno);
+	  }
+	_capacity = header.capacity;
+	return true;
+      }
 
-     for (auto p : ProcessSummary.processes)
-       {
-	 auto _p = p.second;
-	 SingleProc sp({_p->name, _p->state, _p->error, _p->pid,
-	       _p->ppid, _p->pgrp,      _p->session, _p->tty,
-	       _p->pcpu, _p->totalpcpu, _p->flags,   _p->vsize,
-	       _p->start_time, _p->priority, _p->nice, _p->rss});
-	 result[_p->pid] = sp;
-       }
-     return result;
-   }
+      /** Calls f with every sample we can rebuild, oldest first, until it
+	  returns false. Deltas after a lost record are skipped until the next
+	  keyframe. Returns how many samples were given. */
+      unsigned replay(std::function<bool(const Sample&)> f)
+      {
+	if (_map == NULL)
+	  return 0;
+
+	/* (sequence, offset) */
+	const uint8_t* ring = _map + HISTORY_HEADER_SIZE;
+	std::vector<std::pair<uint64_t, uint64_t>> records;
+	historyScan(ring, _capacity, [&records](const HistoryRecord* r, uint64_t off) {
+	    records.push_back(std::make_pair(r->sequence, off));
+	  });
+	std::sort(records.begin(), records.end());
+
+	std::vector<HistoryEntity> entities;
+	std::vector<uint64_t> copy;	/* 8 aligned, as records */
+	bool valid = false;
+	uint64_t last = 0;
+	unsigned given = 0;
+	for (auto rec : records)
+	  {
+	    /* A recorder writing the file can have reused the record since it was
+	       scanned: it's copied and checked again, so what we decode can't change */
+	    const HistoryRecord* live = (const HistoryRecord*)(ring + rec.second);
+	    uint32_t length = __atomic_load_n(&live->length, __ATOMIC_RELAXED);
+	    const HistoryRecord* r = NULL;
+	    if ( (length >= sizeof(HistoryRecord)) && (length % 8 == 0) && (rec.second + length <= _capacity) )
+	      {
+		copy.resize(length / 8);
+		memcpy(copy.data(), live, length);
+		r = (const HistoryRecord*)copy.data();
+		if ( (r->magic != HISTORY_RECORD_MAGIC) || (r->length != length) || (r->sequence != rec.first) ||
+		     (historyRecordCrc(*r, (const uint8_t*)(r+1)) != r->crc) )
+		  r = NULL;
+	      }
+	    if (r == NULL)
+	      {
+		valid = false;	/* lost: deltas after it wait for a keyframe */
+		last = rec.first;
+		continue;
+	      }
+	    bool keyframe = (r->flags & 1);
+	    if (keyframe)
+	      {
+		entities.clear();
+		valid = true;
+	      }
+	    else if (rec.first != last+1)
+	      valid = false;
+	    last = rec.first;
+	    if ( (!valid) || (!apply(r, entities)) )
+	      {
+		valid = false;
+		continue;
+	      }
 
-   /** Gets all process over a %CPU threshold  */
-   static std::vector<SingleProc> getByPCPU(double threshold, bool allTime=false)
-   {
-     std::vector<SingleProc> result;
-     buildProcSummary();
+	    Sample s;
+	    s.sequence = r->sequence;
+	    s.time = std::chrono::system_clock::time_point(std::chrono::microseconds(r->time));
+	    s.keyframe = keyframe;
+	    for (auto& e : entities)
+	      {
+		if (!e.present)
+		  continue;
+		std::vector<double> v(historyFields[e.kind]);
+		for (unsigned i=0; i<v.size(); ++i)
+		  v[i] = historyValue(e.kind, i, e.values[i]);
+		if (e.kind == HISTORY_SYSTEM)
+		  std::copy(v.begin(), v.end(), s.system);
+		else
+		  ((e.kind == HISTORY_MOUNT)?s.mounts:s.processes)[e.name] = v;
+	      }
+	    ++given;
+	    if (!f(s))
+	      break;
+	  }
+	return given;
+      }
 
-     for (auto p : ProcessSummary.processes)
-       {
-	 auto _p = p.second;
-	 SingleProc sp({_p->name, _p->state, _p->error, _p->pid,
-	       _p->ppid, _p->pgrp,      _p->session, _p->tty,
-	       _p->pcpu, _p->totalpcpu, _p->flags,   _p->vsize,
-	       _p->start_time, _p->priority, _p->nice, _p->rss});
-	 if (allTime)
-	   {
-	     if (_p->totalpcpu >= threshold)
-	       result.push_back(sp);
-	   }
-	 else
-	   {
-	     if (_p->pcpu >= threshold)
-	       result.push_back(sp);
-	   }
-       }
+      /** All samples, oldest first  */
+      std::vector<Sample> samples()
+      {
+	std::vector<Sample> result;
+	replay([&result](const Sample& s) {
+	    result.push_back(s);
+	    return true;
+	  });
+	return result;
+      }
 
-     return result;
-   }
+      void close()
+      {
+	if (_map)
+	  munmap(_map, _mapSize);
+	if (_fd != -1)
+	  ::close(_fd);
+	_map = NULL;
+	_fd = -1;
+      }
 
-   /** Gets all process over a %CPU threshold (counting all processes with the same name)  */
-   static std::map<std::string, MultiProc> getByPCPUCol(double threshold, bool allTime=false)
-   {
-     std::map<std::string, MultiProc> result;
-     buildAdvancedSummary();
+      /** errno of last error, 0 if none  */
+      int error()
+      {
+	return _error;
+      }
 
-     for (auto p : ProcessSummary.advanced)
-       {
-	 auto _p = p.second;
+    private:
+      bool fail(int err)
+      {
+	_error = err;
+	close();
+	return false;
+      }
 
-	 if (allTime)
-	   {
-	     if (_p.totalpcpu >=threshold)
-	       result[p.first] = p.second;
-	   }
-	 else
-	   {
-	     if (_p.pcpu >=threshold)
-	       result[p.first] = p.second;
-	   }
-       }
+      /** Applies a record to entities. false if it's malformed */
+      static bool apply(const HistoryRecord* r, std::vector<HistoryEntity>& entities)
+      {
+	HistoryParser p({ (const uint8_t*)(r+1), (const uint8_t*)r + r->length, true });
+	/* End of the payload is padding, an entry tag is never 0 */
+	while ( (p.ok) && (p.pos < p.end) && (*p.pos != 0) )
+	  {
+	    uint64_t tag = p.varint();
+	    uint64_t index = tag >> 2;
+	    if (index > 1000000)
+	      return false;
+	    if (index >= entities.size())
+	      entities.resize(index+1, HistoryEntity({HISTORY_KINDS, "", false, false, {}}));
+	    HistoryEntity& e = entities[index];
+	    switch (tag & 3)
+	      {
+	      case HISTORY_DEFINE:
+		{
+		  e.kind = p.varint();
+		  uint64_t len = p.varint();
+		  if ( (e.kind >= HISTORY_KINDS) || (len > (uint64_t)(p.end - p.pos)) )
+		    return false;
+		  e.name.assign((const char*)p.pos, len);
+		  p.pos+=len;
+		  for (unsigned f=0; f<historyFields[e.kind]; ++f)
+		    e.values[f] = p.zigzag();
+		  e.present = true;
+		  break;
+		}
+	      case HISTORY_DELTA:
+		{
+		  if (!e.present)
+		    return false;
+		  uint64_t mask = p.varint();
+		  for (unsigned f=0; f<historyFields[e.kind]; ++f)
+		    if (mask & (1 << f))
+		      e.values[f]+=p.zigzag();
+		  break;
+		}
+	      case HISTORY_REMOVE:
+		e.present = false;
+		break;
+	      default:
+		return false;
+	      }
+	  }
+	return p.ok;
+      }
 
-     return result;
-   }
+      int _fd;
+      uint8_t* _map;
+      size_t _mapSize;
+      uint64_t _capacity;
+      int _error;
+    };
+  };
 
-   /** Gets all process over a Vsize threshold */
-   static std::vector<SingleProc> getByVsize(unsigned long threshold)
-   {
-     std::vector<SingleProc> result;
-     buildProcSummary();
+  /** Self instrumentation public functions */
+  namespace Stats
+  {
+    /** Stage name, to print it  */
+    static const char* stageName(Stage stage)
+    {
+      static const char* names[STAGE_COUNT] = { "sysinfo", "mounts", "mounts.mtab", "mounts.statfs",
+						"proc", "proc.readdir", "proc.read", "proc.parse",
+						"proc.update", "proc.cleanup", "proc.advanced",
+						"proc.smaps", "proc.step", "proc.fds", "proc.delays", "cgroup", "history", "sensors",
+						"sockets" };
+      return (stage<STAGE_COUNT)?names[stage]:"unknown";
+    }
 
-     for (auto p : ProcessSummary.processes)
-       {
-	 auto _p = p.second;
-	 SingleProc sp({_p->name, _p->state, _p->error, _p->pid,
-	       _p->ppid, _p->pgrp,      _p->session, _p->tty,
-	       _p->pcpu, _p->totalpcpu, _p->flags,   _p->vsize,
-	       _p->start_time, _p->priority, _p->nice, _p->rss});
+    /** Latency histogram of a stage  */
+    static Histogram histogram(Stage stage)
+    {
+      return _statsHistograms[stage];
+    }
 
-	 if (_p->vsize >= threshold)
-	   result.push_back(sp);
-       }
+    /** Library counters  */
+    static Counters counters()
+    {
+      return _statsCounters;
+    }
 
-     return result;
-   }
+    /** Resets all histograms and counters  */
+    static void reset()
+    {
+      memset(_statsHistograms, 0, sizeof(_statsHistograms));
+      memset(&_statsCounters, 0, sizeof(_statsCounters));
+    }
 
-   /** Gets all process over a Vsize threshold (counting all processes with the same name) */
-   static std::map<std::string, MultiProc> getByVsizeCol(unsigned long long threshold)
-   {
-     std::map<std::string, MultiProc> result;
-     buildAdvancedSummary();
+    /* enabled getter/s. Counters are always updated, histograms just when enabled */
+    static bool enabled()
+    {
+      return _statsEnabled;
+    }
 
-     for (auto p : ProcessSummary.advanced)
-       {
-	 auto _p = p.second;
+    static bool enabled(bool val)
+    {
+      _statsEnabled = val;
+      return _statsEnabled;
+    }
 
-	 if (_p.totalvsize >= threshold)
-	   result[p.first] = p.second;
-       }
+    /* sample rate getter/s. Process stages are measured once every val processes */
+    static unsigned sampleRate()
+    {
+      return _statsSampleRate;
+    }
 
-     return result;
-   }
+    static unsigned sampleRate(unsigned val)
+    {
+      if (val > 0)
+	_statsSampleRate = val;
 
- };
+      return _statsSampleRate;
+    }
+  };
+  };
+#ifdef UMON_PRIVATE_STATE
+  };
+#endif
 };
 
+#undef UMON_CONFIG_NAME
+#undef UMON_CONFIG_NAME2
+#undef UMON_CONFIG_URING
+#undef UMON_CONFIG_THREADS
 
 #endif /* _UMON_H */
 